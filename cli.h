@@ -8,6 +8,7 @@
 #include "CLI11.hpp"
 #include "globals.h"
 #include "rang.hpp"
+#include "kmer_offset.h"
 #include <memory>
 #include <thread>
 
@@ -42,6 +43,26 @@ public:
 			if (mLowerKmerSize > mUpperKmerSize)
 				throw CLI::ValidationError("Invalid values for lower and upper k-mer size");
 
+			if (mPeptides && mExportFile.empty())
+				throw CLI::ValidationError("The peptides mode requires an export file (--export)");
+
+			if (mSeqMajor && !mExportFile.empty())
+				throw CLI::ValidationError("The sequence-major mode (--by-sequence) does not support --export");
+
+			if (mSeqMajor && mMemoryLimit > 0)
+				throw CLI::ValidationError("The sequence-major mode (--by-sequence) does not support --memory-limit");
+
+			if (mFused && (mAware || mSeqMajor))
+				throw CLI::ValidationError("The fused mode (--fused) does not support --aware, nor --by-sequence");
+
+			if (mMinOccurrences == 0)
+				mMinOccurrences = 1;
+
+			// The occurrences of a k-mer are counted up to "MAX_COUNT"
+			if (mMinOccurrences > fasta::KmerOffset::MAX_COUNT)
+				throw CLI::ValidationError("The minimum number of occurrences (--min-occurrences) must be at most " +
+				                           std::to_string(fasta::KmerOffset::MAX_COUNT));
+
 			if (mWritePreds > Globals::WRITE_BOTHS_PREDS)
 				mWritePreds = Globals::WRITE_NONE_PREDS;
 
@@ -72,6 +93,10 @@ public:
 		std::cout << style::bold << fg::green << "SVM's scaling file: " << style::reset << fg::green
 		          << mScalingFile << style::reset << "\n";
 
+		std::cout << style::bold << fg::green << "Molecular descriptors: " << style::reset << fg::green
+		          << (mDescriptorsFile.empty() ? "default (" + std::to_string(Globals::NUM_MDS) + " MDs)" :
+		              mDescriptorsFile) << style::reset << "\n";
+
 		std::cout << style::bold << fg::green << "Lower k-mer size: " << style::reset << fg::green
 		          << std::to_string(mLowerKmerSize) << style::reset << "\n";
 
@@ -93,9 +118,29 @@ public:
 		else if (mWritePreds == Globals::WRITE_BOTHS_PREDS)
 			std::cout << "boths (amps, namps)" << style::reset << "\n";
 
+		std::cout << style::bold << fg::green << "Descriptors & predictions cache: " << style::reset << fg::green
+		          << (mCacheFile.empty() ? "none" : mCacheFile + " (" + std::to_string(mCacheSize) + " MB)")
+		          << style::reset << "\n";
+
+		std::cout << style::bold << fg::green << "Export molecular descriptors: " << style::reset << fg::green
+		          << (mExportFile.empty() ? "none" : mExportFile + (mPeptides ? " (peptides)" : " (unique k-mers)"))
+		          << style::reset << "\n";
+
         std::cout << style::bold << fg::green << "Aware memory mode (low-memory consumption): "
                   << style::reset << fg::green << ((mAware) ? "true" : "false") << style::reset << "\n";
 
+		std::cout << style::bold << fg::green << "Minimum occurrences of the k-mers: " << style::reset << fg::green
+		          << mMinOccurrences << style::reset << "\n";
+
+		std::cout << style::bold << fg::green << "Memory budget: " << style::reset << fg::green
+		          << (mMemoryLimit == 0 ? "none" : std::to_string(mMemoryLimit) + " MB") << style::reset << "\n";
+
+		std::cout << style::bold << fg::green << "Sequence-major extraction (all k-mer sizes at once): "
+		          << style::reset << fg::green << ((mSeqMajor) ? "true" : "false") << style::reset << "\n";
+
+		std::cout << style::bold << fg::green << "Fused mode (shrink while extracting): " << style::reset
+		          << fg::green << ((mFused) ? "true" : "false") << style::reset << "\n";
+
 		std::cout << style::bold << fg::green << "Verbose mode (show extra info.): " << style::reset << fg::green
 		          << ((mVerbose) ? "true" : "false") << style::reset << "\n";
 
@@ -123,6 +168,10 @@ public:
 		return mModelFile;
 	}
 
+	const std::string& getDescriptorsFile() const {
+		return mDescriptorsFile;
+	}
+
 	uint getLowerKmer() const {
 		return mLowerKmerSize;
 	}
@@ -139,10 +188,42 @@ public:
 		return mWritePreds;
 	}
 
+	const std::string& getCacheFile() const {
+		return mCacheFile;
+	}
+
+	size_t getCacheSize() const {
+		return mCacheSize;
+	}
+
+	const std::string& getExportFile() const {
+		return mExportFile;
+	}
+
+	bool hasPeptidesMode() const {
+		return mPeptides;
+	}
+
     bool hasAwareMode() const {
         return mAware;
     }
 
+	uint getMinOccurrences() const {
+		return mMinOccurrences;
+	}
+
+	size_t getMemoryLimit() const {
+		return mMemoryLimit;
+	}
+
+	bool hasSeqMajorMode() const {
+		return mSeqMajor;
+	}
+
+	bool hasFusedMode() const {
+		return mFused;
+	}
+
 	bool hasVerboseMode() const {
 		return mVerbose;
 	}
@@ -175,6 +256,12 @@ private:
 		                "SVM's model file")
 				->required()->check(CLI::ExistingFile);
 
+		mApp.add_option("-d,--descriptors",
+		                mDescriptorsFile,
+		                "Molecular descriptors set's file (default = the " + std::to_string(Globals::NUM_MDS) +
+		                " built-in MDs)")
+				->check(CLI::ExistingFile);
+
 		mApp.add_option("-l,--lower",
 		                mLowerKmerSize,
 		                "Lower k-mer size (mininum = " + std::to_string(Globals::MIN_KMER_SIZE) + " )")
@@ -205,7 +292,43 @@ private:
 		mApp.add_option("-w,--write", mWritePreds,
 		                "Write predicteds k-mers (0 = none, 1 = amps, 2 = amps, 3 = both; default = none");
 
-        mApp.add_flag("-a,--aware", mAware, "Enable aware mode (low-memory consumption; default false)");
+		mApp.add_option("-c,--cache", mCacheFile,
+		                "On-disk cache of molecular descriptors and predictions, reused between runs "
+		                "(default = none)");
+
+		mApp.add_option("--cache-size", mCacheSize,
+		                "Maximum size (in MB) of the cache file (default = 1024)")
+				->check([] (std::string size) {
+					return std::stoul(size) > 0;
+				});
+
+		mApp.add_option("-e,--export", mExportFile,
+		                "Export the molecular descriptors of the unique k-mers to a NPY file (and the "
+		                "k-mers to <file>.kmers; default = none)");
+
+		mApp.add_flag("--peptides", mPeptides,
+		              "Only export the molecular descriptors of the input's sequences, taken as a list of "
+		              "peptides (requires --export; default false)");
+
+        mApp.add_flag("-a,--aware", mAware, "Enable aware mode (low-memory consumption): all the occurrences "
+                      "of the AMPs are spilled to disk, as with no memory budget for them (default false)");
+
+		mApp.add_option("--min-occurrences", mMinOccurrences,
+		                "Minimum number of occurrences (in the proteome) of the k-mers to evaluate "
+		                "(up to 65535; default = 1, all of them)");
+
+		mApp.add_option("--memory-limit", mMemoryLimit,
+		                "Memory budget (in MB): only the phases that do not fit are moved to disk (the k-mers "
+		                "are partitioned into on-disk buckets and/or the occurrences of the AMPs are spilled; "
+		                "default = none)");
+
+		mApp.add_flag("--by-sequence", mSeqMajor,
+		              "Extract the k-mers sequence by sequence, evaluating all the k-mer sizes of each "
+		              "start offset at once (instead of one k-mer size at a time; default false)");
+
+		mApp.add_flag("-f,--fused", mFused,
+		              "Shrink the proteome while extracting the k-mers: the occurrences of every k-mer "
+		              "predicted as AMP are marked right away, so the AMPs are never kept (default false)");
 
 		mApp.add_flag("-v,--verbose", mVerbose, "Enable verbose mode (show extra information; default false)");
 
@@ -218,11 +341,20 @@ private:
 	std::string mOutputBaseName;
 	std::string mScalingFile;
 	std::string mModelFile;
+	std::string mDescriptorsFile;
 	uint mLowerKmerSize;
 	uint mUpperKmerSize;
 	int mNumThreads = 0;
 	uint mWritePreds = Globals::WRITE_NONE_PREDS;
+	std::string mCacheFile;
+	size_t mCacheSize = 1024;
+	std::string mExportFile;
+	bool mPeptides = false;
     bool mAware = false;
+	bool mSeqMajor = false;
+	bool mFused = false;
+	size_t mMemoryLimit = 0;
+	uint mMinOccurrences = 1;
 	bool mVerbose = false;
 
 };
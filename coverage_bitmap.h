@@ -0,0 +1,189 @@
+#ifndef INPROT_COVERAGE_BITMAP_H
+#define INPROT_COVERAGE_BITMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "fasta_seq.h"
+
+namespace fasta {
+
+	// Residues of a sequence covered by (AMP) k-mers, one bit per residue: the k-mers are marked as
+	// ranges of bits and the covered regions are found by scanning whole words (skipping the
+	// uncovered/covered runs with count-trailing-zeros), so merging the k-mers is linear in the
+	// length of the sequence.
+	class CoverageBitmap {
+
+	public:
+		//
+		// Methods
+		//
+
+		// Clear the bitmap for a sequence of length "len" (the memory is reused)
+		void reset(size_t len) {
+			mLength = len;
+			mWords.assign((len + 63) / 64, 0);
+		}
+
+		// Mark the residues [begin, end) as covered
+		void mark(size_t begin, size_t end) {
+			if (begin >= end)
+				return;
+
+			auto first = begin / 64;
+			auto last = (end - 1) / 64;
+			auto firstMask = ~uint64_t {0} << (begin % 64);
+			auto lastMask = ~uint64_t {0} >> (63 - (end - 1) % 64);
+
+			if (first == last) {
+				mWords[first] |= firstMask & lastMask;
+				return;
+			}
+
+			mWords[first] |= firstMask;
+			std::fill(mWords.begin() + first + 1, mWords.begin() + last, ~uint64_t {0});
+			mWords[last] |= lastMask;
+		}
+
+		// Mark the residues of the word "w" whose bits are set in "bits"
+		void markWord(size_t w, uint64_t bits) {
+			mWords[w] |= bits;
+		}
+
+		// Call "emit(begin, end)" for every covered region, in order: the maximal runs of covered
+		// residues, where two runs separated by up to "maxGap" uncovered residues are joined
+		template<typename F>
+		void regions(size_t maxGap, F&& emit) const {
+			auto begin = next(0, true);
+
+			while (begin < mLength) {
+				auto end = next(begin, false);
+
+				while (end < mLength) {
+					auto nextBegin = next(end, true);
+
+					if (nextBegin >= mLength || nextBegin - end > maxGap)
+						break;
+
+					end = next(nextBegin, false);
+				}
+
+				emit(begin, end);
+				begin = next(end, true);
+			}
+		}
+
+	private:
+		// Position of the first residue, from "pos", covered (if "covered") or not; the length of
+		// the sequence if there is none
+		size_t next(size_t pos, bool covered) const {
+			if (pos >= mLength)
+				return mLength;
+
+			auto w = pos / 64;
+			auto word = (covered ? mWords[w] : ~mWords[w]) & (~uint64_t {0} << (pos % 64));
+
+			while (word == 0) {
+				if (++w == mWords.size())
+					return mLength;
+
+				word = covered ? mWords[w] : ~mWords[w];
+			}
+
+			return std::min(w * 64 + static_cast<size_t>(__builtin_ctzll(word)), mLength);
+		}
+
+		size_t mLength {0};
+		std::vector<uint64_t> mWords;
+
+	};
+
+	// Coverage of all the sequences at once, marked concurrently (fused mode): every sequence has
+	// its own words (starting at a word boundary) and they are set with atomic "fetch_or", so the
+	// k-mers of any sequence can be marked from any thread.
+	class ProteomeCoverage {
+
+	public:
+		//
+		// Methods
+		//
+
+		// Clear the coverage of the sequences "fseqs"
+		void reset(const FastaSeqs& fseqs) {
+			mLengths.resize(fseqs.size());
+			mFirstWords.assign(fseqs.size() + 1, 0);
+
+			for (size_t i = 0; i < fseqs.size(); ++i) {
+				mLengths[i] = fseqs[i].length();
+				mFirstWords[i + 1] = mFirstWords[i] + (mLengths[i] + 63) / 64;
+			}
+
+			mWords.reset(new std::atomic<uint64_t>[mFirstWords.back()]);
+
+			for (size_t w = 0; w < mFirstWords.back(); ++w)
+				mWords[w].store(0, std::memory_order_relaxed);
+		}
+
+		// Mark the residues [begin, end) of the sequence "seqIdx" as covered
+		void mark(size_t seqIdx, size_t begin, size_t end) {
+			if (begin >= end)
+				return;
+
+			auto words = mWords.get() + mFirstWords[seqIdx];
+			auto first = begin / 64;
+			auto last = (end - 1) / 64;
+			auto firstMask = ~uint64_t {0} << (begin % 64);
+			auto lastMask = ~uint64_t {0} >> (63 - (end - 1) % 64);
+
+			if (first == last) {
+				markWord(words[first], firstMask & lastMask);
+				return;
+			}
+
+			markWord(words[first], firstMask);
+
+			for (auto w = first + 1; w < last; ++w)
+				markWord(words[w], ~uint64_t {0});
+
+			markWord(words[last], lastMask);
+		}
+
+		// Copy the coverage of the sequence "seqIdx" into "bitmap" (false if nothing is covered)
+		bool load(size_t seqIdx, CoverageBitmap& bitmap) const {
+			auto first = mFirstWords[seqIdx];
+			auto last = mFirstWords[seqIdx + 1];
+			bool covered {false};
+
+			bitmap.reset(mLengths[seqIdx]);
+
+			for (auto w = first; w < last; ++w) {
+				auto bits = mWords[w].load(std::memory_order_relaxed);
+
+				if (bits != 0) {
+					bitmap.markWord(w - first, bits);
+					covered = true;
+				}
+			}
+
+			return covered;
+		}
+
+	private:
+		// Overlapped k-mers mark the same residues again and again, so the bits already set are
+		// checked before writing (to not contend for the cache line)
+		static void markWord(std::atomic<uint64_t>& word, uint64_t bits) {
+			if ((word.load(std::memory_order_relaxed) & bits) != bits)
+				word.fetch_or(bits, std::memory_order_relaxed);
+		}
+
+		std::vector<size_t> mLengths;
+		std::vector<size_t> mFirstWords;    // First word of every sequence (plus the end)
+		std::unique_ptr<std::atomic<uint64_t>[]> mWords;
+
+	};
+
+}
+
+#endif //INPROT_COVERAGE_BITMAP_H
@@ -0,0 +1,238 @@
+#ifndef INPROT_FASTA_READER_H
+#define INPROT_FASTA_READER_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tbb/tbb.h>
+#include "globals.h"
+#include "fasta_seq.h"
+#include "thread_buffers.h"
+
+namespace fasta {
+
+	// Reader of FASTA files: the file is memory-mapped (or read at once, if it cannot be mapped)
+	// and parsed in parallel. First the header lines ('>' at the start of a line) are found by
+	// chunks, then the records are delimited and every record is validated, upper-cased and
+	// stripped of its newlines on its own, straight into the arenas of the table.
+	//
+	// The records are the ones of the line-by-line reading: a header only closes the previous
+	// record once a description was read (the headers with an empty description are merged into
+	// the following record) and the description is the header up to, and including, its first
+	// space. A line with a leading space or with a residue out of the alphabet is an error.
+	class FastaReader {
+
+	public:
+		static FastaSeqs read(const std::string& filename) {
+			auto fd = ::open(filename.c_str(), O_RDONLY);
+
+			if (fd < 0)
+				return FastaSeqs();
+
+			struct stat st {};
+			auto size = (fstat(fd, &st) == 0) ? static_cast<size_t>(st.st_size) : 0;
+			auto addr = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+			::close(fd);
+
+			if (addr == MAP_FAILED) {
+				// Not a regular file (or empty): read it whole
+				std::ifstream inFile(filename, std::ios_base::in | std::ios_base::binary);
+				std::ostringstream data;
+				data << inFile.rdbuf();
+
+				auto text = data.str();
+				return parse(text.data(), text.size());
+			}
+
+			madvise(addr, size, MADV_SEQUENTIAL);
+
+			try {
+				auto fseqs = parse(static_cast<const char*>(addr), size);
+				munmap(addr, size);
+
+				return fseqs;
+			} catch (...) {
+				munmap(addr, size);
+				throw;
+			}
+		}
+
+	private:
+		// Bytes per chunk when looking for the headers
+		static constexpr size_t MIN_CHUNK = 1 << 20;
+
+		static FastaSeqs parse(const char* data, size_t size) {
+			auto headers = findHeaders(data, size);
+
+			// A header starts a new record only if the current one already has a description (a
+			// header line longer than ">")
+			std::vector<size_t> firstHeaders;
+			std::vector<size_t> starts {0};
+			bool hasDesc {false};
+
+			for (size_t h = 0; h < headers.size(); ++h) {
+				if (hasDesc) {
+					starts.push_back(headers[h]);
+					firstHeaders.push_back(h);
+					hasDesc = false;
+				}
+
+				auto next = headers[h] + 1;
+				hasDesc = hasDesc || (next < size && data[next] != '\n');
+			}
+
+			firstHeaders.insert(firstHeaders.begin(), 0);
+			firstHeaders.push_back(headers.size());
+			starts.push_back(size);
+
+			// The records are parsed twice (in parallel): to validate and measure them and then, once
+			// the arenas are laid out, to write them
+			auto numRecords = starts.size() - 1;
+			std::vector<size_t> lengths(numRecords);
+			std::vector<size_t> descLengths(numRecords, 0);
+			std::atomic<size_t> firstError {size};
+
+			tbb::parallel_for(size_t {0}, numRecords, [&] (size_t r) {
+				for (auto h = firstHeaders[r]; h < firstHeaders[r + 1]; ++h)
+					descLengths[r] += descLength(data + headers[h], lineEnd(data, headers[h], size) - headers[h]);
+
+				auto error = parseSeq(data, starts[r], starts[r + 1], nullptr, lengths[r]);
+
+				if (error < size) {
+					auto current = firstError.load();
+
+					while (error < current && !firstError.compare_exchange_weak(current, error));
+				}
+			});
+
+			if (firstError < size) {
+				auto numLine = 1 + std::count(data, data + firstError, '\n');
+				throw std::runtime_error("Line " + std::to_string(numLine) + " has invalid characters");
+			}
+
+			FastaSeqs fseqs(lengths, descLengths);
+
+			tbb::parallel_for(size_t {0}, numRecords, [&] (size_t r) {
+				auto desc = fseqs.descData(r);
+				size_t len {0};
+
+				for (auto h = firstHeaders[r]; h < firstHeaders[r + 1]; ++h) {
+					auto line = data + headers[h];
+					auto descLen = descLength(line, lineEnd(data, headers[h], size) - headers[h]);
+
+					desc = std::copy(line + 1, line + 1 + descLen, desc);
+				}
+
+				parseSeq(data, starts[r], starts[r + 1], fseqs.seqData(r), len);
+			});
+
+			return fseqs;
+		}
+
+		// Position of every header line, in order
+		static std::vector<size_t> findHeaders(const char* data, size_t size) {
+			auto chunkSize = std::max(size_t {MIN_CHUNK}, size / (8 * std::max(1u, std::thread::hardware_concurrency())));
+			auto numChunks = (size + chunkSize - 1) / chunkSize;
+			std::vector<std::vector<size_t>> chunkHeaders(numChunks);
+
+			tbb::parallel_for(size_t {0}, numChunks, [&] (size_t c) {
+				auto& headers = chunkHeaders[c];
+				auto pos = c * chunkSize;
+				auto end = std::min(size, pos + chunkSize);
+
+				if (pos == 0 && size > 0 && data[0] == '>')
+					headers.push_back(0);
+
+				// Every newline of the chunk starts a line
+				while (pos < end) {
+					auto nl = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+
+					if (nl == nullptr)
+						break;
+
+					pos = static_cast<size_t>(nl - data) + 1;
+
+					if (pos < size && data[pos] == '>')
+						headers.push_back(pos);
+				}
+			});
+
+			return ThreadBuffers::concat(chunkHeaders);
+		}
+
+		static size_t lineEnd(const char* data, size_t pos, size_t end) {
+			auto nl = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+			return (nl != nullptr) ? static_cast<size_t>(nl - data) : end;
+		}
+
+		// The description of a header is up to (and including) its first space
+		static size_t descLength(const char* line, size_t len) {
+			auto space = static_cast<const char*>(std::memchr(line, ' ', len));
+			auto last = (space != nullptr) ? space + 1 : line + len;
+
+			return static_cast<size_t>(last - line) - 1;
+		}
+
+		// Residues (upper-cased) of the lines [begin, end) that are not headers, written to "out"
+		// (if given) and counted in "len". Returns the position of the first invalid line (the
+		// maximum "size_t" if there is none)
+		static size_t parseSeq(const char* data, size_t begin, size_t end, char* out, size_t& len) {
+			static const auto residues = residuesTable();
+
+			for (auto pos = begin; pos < end; ) {
+				auto last = lineEnd(data, pos, end);
+
+				if (pos < last && data[pos] != '>') {
+					if (data[pos] == ' ')
+						return pos;
+
+					for (auto i = pos; i < last; ++i) {
+						auto residue = residues[static_cast<unsigned char>(data[i])];
+
+						if (residue == 0)
+							return pos;
+
+						if (out != nullptr)
+							out[len] = residue;
+
+						++len;
+					}
+				}
+
+				pos = last + 1;
+			}
+
+			return std::numeric_limits<size_t>::max();
+		}
+
+		// Upper-cased residue of every character (0 if it is not in the alphabet)
+		static std::array<char, 256> residuesTable() {
+			std::array<char, 256> table {};
+
+			for (int c = 0; c < 256; ++c) {
+				auto upper = static_cast<char>(::toupper(c));
+
+				if (Globals::ALPHABET.find(upper) != std::string::npos)
+					table[c] = upper;
+			}
+
+			return table;
+		}
+
+	};
+
+}
+
+#endif //INPROT_FASTA_READER_H
@@ -6,13 +6,18 @@
 #define INPROT_FASTASEQ_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <numeric>
+#include <algorithm>
 #include <utility>
+#include <cstdint>
+#include <cstring>
 #include <tbb/tbb.h>
 
 namespace fasta {
 
-
-
+    // View of a sequence (and its description) stored in the arenas of its table ("FastaSeqs")
     class FastaSeq {
 
     public:
@@ -20,36 +25,180 @@ namespace fasta {
 	    // Constructors & destructors
 	    //
         FastaSeq() = default;
-        explicit FastaSeq(std::string seq, std::string desc): mSeq(std::move(seq)), mDesc(std::move(desc)) {}
+        explicit FastaSeq(const char* seq, size_t length, const char* desc, size_t descLength, size_t index):
+		        mSeq(seq), mDesc(desc), mLength(static_cast<uint32_t>(length)),
+		        mDescLength(static_cast<uint32_t>(descLength)), mIndex(static_cast<uint32_t>(index)) {}
 
 	    //
 	    // Methods
 	    //
+	    int compare(const FastaSeq& rhs) const {
+		    auto cmp = std::memcmp(mSeq, rhs.mSeq, std::min(mLength, rhs.mLength));
+
+		    if (cmp != 0)
+			    return cmp;
+
+		    return (mLength == rhs.mLength) ? 0 : (mLength < rhs.mLength ? -1 : 1);
+	    }
+
 		bool operator<(const FastaSeq& rhs) const {
-			return mSeq < rhs.mSeq;
+			return compare(rhs) < 0;
 		}
 
 	    size_t length() const {
-		    return mSeq.length();
+		    return mLength;
 	    }
 
 	    //
 	    // Getters & setters
 	    //
-	    const std::string& getSeq() const {
+	    const char* data() const {
 		    return mSeq;
 	    }
 
-	    const std::string& getDesc() const {
+	    const char* descData() const {
 		    return mDesc;
 	    }
 
+	    size_t descLength() const {
+		    return mDescLength;
+	    }
+
+	    // Index of the sequence in its table
+	    size_t getIndex() const {
+		    return mIndex;
+	    }
+
     private:
-        std::string mSeq;
-        std::string mDesc;
+        const char* mSeq {nullptr};
+        const char* mDesc {nullptr};
+        uint32_t mLength {0};
+        uint32_t mDescLength {0};
+        uint32_t mIndex {0};
 
     };
 
+	// Table of sequences (k-mers and groups refer to their sequences by index). The residues of all
+	// the sequences are stored back to back in one arena and their descriptions in another one, so
+	// the sequences are views into the arenas (which also act as the table of offsets).
+	class FastaSeqs {
+
+	public:
+		using const_iterator = std::vector<FastaSeq>::const_iterator;
+
+		//
+		// Constructors & destructors
+		//
+		FastaSeqs() = default;
+		FastaSeqs(FastaSeqs&&) = default;
+		FastaSeqs& operator=(FastaSeqs&&) = default;
+		FastaSeqs(const FastaSeqs&) = delete;
+		FastaSeqs& operator=(const FastaSeqs&) = delete;
+
+		// Table of sequences of the given lengths (and lengths of their descriptions), laid out in
+		// order in the arenas. Their contents are written afterwards (see "seqData" and "descData")
+		explicit FastaSeqs(const std::vector<size_t>& lengths, const std::vector<size_t>& descLengths):
+				mSeqs(lengths.size()) {
+
+			auto numResidues = std::accumulate(lengths.cbegin(), lengths.cend(), size_t {0});
+			auto descBytes = std::accumulate(descLengths.cbegin(), descLengths.cend(), size_t {0});
+
+			mResidues.reset(new char[std::max<size_t>(1, numResidues)]);
+			mDescs.reset(new char[std::max<size_t>(1, descBytes)]);
+			mNumResidues = numResidues;
+			mDescBytes = descBytes;
+
+			size_t offset {0};
+			size_t descOffset {0};
+
+			for (size_t i = 0; i < mSeqs.size(); ++i) {
+				mSeqs[i] = FastaSeq(mResidues.get() + offset, lengths[i], mDescs.get() + descOffset, descLengths[i], i);
+				offset += lengths[i];
+				descOffset += descLengths[i];
+			}
+		}
+
+		//
+		// Methods
+		//
+
+		// Table of the sequences "order" (indexes of this one), in that order
+		FastaSeqs select(const std::vector<size_t>& order) const {
+			std::vector<size_t> lengths(order.size());
+			std::vector<size_t> descLengths(order.size());
+
+			for (size_t i = 0; i < order.size(); ++i) {
+				lengths[i] = mSeqs[order[i]].length();
+				descLengths[i] = mSeqs[order[i]].descLength();
+			}
+
+			FastaSeqs selected(lengths, descLengths);
+
+			tbb::parallel_for(size_t {0}, order.size(), [&] (size_t i) {
+				const auto& fs = mSeqs[order[i]];
+				std::memcpy(selected.seqData(i), fs.data(), fs.length());
+				std::memcpy(selected.descData(i), fs.descData(), fs.descLength());
+			});
+
+			return selected;
+		}
+
+		const FastaSeq& operator[](size_t i) const {
+			return mSeqs[i];
+		}
+
+		size_t size() const {
+			return mSeqs.size();
+		}
+
+		bool empty() const {
+			return mSeqs.empty();
+		}
+
+		const_iterator begin() const {
+			return mSeqs.cbegin();
+		}
+
+		const_iterator end() const {
+			return mSeqs.cend();
+		}
+
+		const_iterator cbegin() const {
+			return mSeqs.cbegin();
+		}
+
+		const_iterator cend() const {
+			return mSeqs.cend();
+		}
+
+		// Bytes of the table (views and arenas)
+		size_t bytes() const {
+			return mSeqs.size() * sizeof(FastaSeq) + mNumResidues + mDescBytes;
+		}
+
+		//
+		// Getters & setters
+		//
+
+		// Residues (and description) of the sequence "i", to be written (the views point into the
+		// arenas, which belong to the table)
+		char* seqData(size_t i) {
+			return const_cast<char*>(mSeqs[i].data());
+		}
+
+		char* descData(size_t i) {
+			return const_cast<char*>(mSeqs[i].descData());
+		}
+
+	private:
+		std::vector<FastaSeq> mSeqs;
+		std::unique_ptr<char[]> mResidues;
+		std::unique_ptr<char[]> mDescs;
+		size_t mNumResidues {0};
+		size_t mDescBytes {0};
+
+	};
+
 }
 
 
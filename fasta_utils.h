@@ -8,12 +8,19 @@
 
 #include <vector>
 #include "fasta_seq.h"
+#include "fasta_reader.h"
 #include <fstream>
 #include <sstream>
 #include "globals.h"
 #include "kmer_offset.h"
+#include "kmer_hash.h"
+#include "kmer_key.h"
+#include "thread_buffers.h"
+#include "seq_chunks.h"
+#include "kmer_occurrences.h"
 #include <algorithm>
 #include <numeric>
+#include <cstring>
 #include <tbb/tbb.h>
 #include <tbb/concurrent_vector.h>
 
@@ -23,151 +30,357 @@ namespace fasta {
     class FastaUtils {
 
     public:
-        static tbb::concurrent_vector<FastaSeq> readFasta(const std::string& filename) {
-            std::ifstream inFile(filename, std::ios_base::in | std::ios_base::binary);
+        static FastaSeqs readFasta(const std::string& filename) {
+            // Parsed in parallel from the memory-mapped file (see "FastaReader")
+            auto fseqs = FastaReader::read(filename);
 
-            if (!inFile) {
-	            return tbb::concurrent_vector<FastaSeq>();
+            if (fseqs.empty()) {
+                return fseqs;
             }
 
-	        // Create vector of fasta sequences with an initial space for 100,000 fasta sequences
-	        tbb::concurrent_vector<FastaSeq> fseqs;
-            fseqs.reserve(20'000);
-            std::string line;
-            std::string seq;
-            std::string desc;
-            size_t numLine {1};
+            // Sequences sorted by their residues (between equal ones, the first of the file is kept)
+            std::vector<size_t> order(fseqs.size());
+            std::iota(order.begin(), order.end(), size_t {0});
 
-            while(std::getline(inFile, line)) {
-                // If the first character is a space, then, "space_idx" variable will be greater
-                // than zero
-                auto space_idx = line.find_first_not_of(' ');
+            tbb::parallel_sort(order.begin(), order.end(), [&fseqs] (size_t i, size_t j) {
+                auto cmp = fseqs[i].compare(fseqs[j]);
+                return (cmp != 0) ? cmp < 0 : i < j;
+            });
+
+            auto lastUnique = std::unique(order.begin(), order.end(), [&fseqs] (size_t i, size_t j) {
+                return fseqs[i].compare(fseqs[j]) == 0;
+            });
+
+            if (lastUnique != order.end()) {
+                auto totUniques = static_cast<size_t>(std::distance(order.begin(), lastUnique));
+                auto totDuplicates = fseqs.size() - totUniques;
 
-                if (space_idx > 0 && line.length() > 0) {
-                    throw std::runtime_error("Line " + std::to_string(numLine) + " has invalid characters");
-                }
+                std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
+                          << "A total of " << fseqs.size() << " sequences read with " << totUniques
+                          << " uniques (" << totDuplicates << " duplicates)" << style::reset << std::endl;
 
-                // If the line begins with ">" character, then, is a description line
-                if (line[0] == '>') {
-                    space_idx = line.find_first_of(' ');
+                order.erase(lastUnique, order.end());
+            }
 
-                    if (desc.length() > 0) {
+            // The uniques are laid out in their (sorted) order, so their indexes do not depend on the
+            // threads and a scan by index reads the arenas sequentially
+            return fseqs.select(order);
+        }
 
-                        // Shrink to reduce memory usage
-                        seq.shrink_to_fit();
-                        desc.shrink_to_fit();
+		// Unique k-mers of size "ksize". Between equal k-mers, the one of the first sequence (and
+		// lowest offset) is kept. Short k-mers (up to 12 residues) are deduplicated by their 64-bit
+		// packed keys (see "KmerKey"), the longer ones by their hashes (the 128-bit records double
+		// the memory traffic of the sort, which makes them slower than hashing). If "occurrences"
+		// is given, all the occurrences of every unique k-mer are kept in it.
+		static std::vector<KmerOffset> uniqKmers(
+                const FastaSeqs& fseqs, uint32_t ksize,
+                KmerOccurrences* occurrences = nullptr) {
 
-                        // Insert new fasta sequence
-                        fseqs.emplace_back(seq, desc);
-                        desc.clear();
-                        seq.clear();
-                    }
+			if (ksize > 0 && ksize <= KmerKey::maxSize<uint64_t>())
+				return uniqPackedKmers<uint64_t>(fseqs, ksize, occurrences);
 
-                    desc += line.substr(1, space_idx == std::string::npos ? line.length() : space_idx);
+			return uniqHashedKmers(fseqs, ksize, occurrences);
+		}
 
-                } else {
+    private:
+	    // Every k-mer occurrence (enumerated by chunks of similar size, see "SeqChunks") is packed
+	    // into a key (of type "K") and sent to one of the buckets by the key's higher 8 bits; then,
+	    // every bucket is radix sorted (by the rest of the key's bits) and deduplicated on its own
+	    template<typename K>
+	    static std::vector<KmerOffset> uniqPackedKmers(
+			    const FastaSeqs& fseqs, uint32_t ksize, KmerOccurrences* occurrences) {
 
-                    // Convert sequence line to upper-case
-                    std::transform(line.begin(), line.end(), line.begin(), ::toupper);
+		    if (occurrences != nullptr)
+			    *occurrences = KmerOccurrences();
 
-                    // Check if only contains valid standard aminoacids
-                    if (!isValid(line)) {
-                        throw std::runtime_error(
-                                "Line " + std::to_string(numLine) + " has invalid characters");
-                    }
+		    if (totalKmers(fseqs, ksize) == 0)
+			    return std::vector<KmerOffset>();
 
-                    seq += line;
-                }
+		    constexpr size_t numBuckets {256};
 
-                ++numLine;
-            }
+		    // Phase 1: pack every occurrence into the thread's local buckets
+		    tbb::enumerable_thread_specific<std::vector<std::vector<PackedOcc<K>>>> localBuckets(
+				    [] { return std::vector<std::vector<PackedOcc<K>>>(numBuckets); });
 
-            fseqs.emplace_back(seq, desc);
-            tbb::parallel_sort(fseqs);
+		    auto chunks = SeqChunks::split(fseqs, ksize);
 
-            auto lastUnique = std::unique(fseqs.begin(), fseqs.end(), [] (const auto& fi, const auto& fj) {
-                return &fi == &fj || fi.getSeq() == fj.getSeq();
-            });
+		    tbb::parallel_for(size_t {0}, chunks.size(), [&] (size_t c) {
+			    auto& buckets = localBuckets.local();
+			    const auto& chunk = chunks[c];
 
-            if (lastUnique != fseqs.end()) {
-                auto totUniques = static_cast<size_t>(std::distance(fseqs.begin(), lastUnique));
-                auto totDuplicates = fseqs.size() - totUniques;
+			    for (auto i = chunk.firstSeq; i < chunk.lastSeq; ++i) {
+				    const auto& seq = fseqs[i];
+				    auto starts = chunk.starts(seq.length(), ksize);
 
-                std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
-                          << "A total of " << fseqs.size() << " sequences read with " << totUniques
-                          << " uniques (" << totDuplicates << " duplicates)" << style::reset << std::endl;
+				    if (starts.first == starts.second)
+					    continue;
 
-                tbb::concurrent_vector<FastaSeq> uniqs;
-                uniqs.reserve(static_cast<size_t>(totUniques));
+				    auto data = seq.data();
+				    auto key = KmerKey::pack<K>(data + starts.first, ksize);
 
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, totUniques), [&] (const auto& r) {
+				    for (auto offset = starts.first; offset < starts.second; ++offset) {
+					    if (offset > starts.first)
+						    key = KmerKey::roll(key, data[offset + ksize - 1], ksize);
 
-                    for (auto i = r.begin(); i != r.end(); ++i)
-                        uniqs.emplace_back(fseqs[i]);
-                });
+					    buckets[KmerKey::bucket(key)].push_back(PackedOcc<K> {key, static_cast<uint32_t>(i),
+					                                                          static_cast<uint32_t>(offset)});
+				    }
+			    }
+		    });
 
-                fseqs.clear();
-                uniqs.shrink_to_fit();
-                return uniqs;
+		    // Phase 2: sort and deduplicate every bucket (in parallel)
+		    std::vector<std::vector<KmerOffset>> bucketUniqs(numBuckets);
+		    std::vector<KmerOccurrences> bucketOccs(occurrences != nullptr ? numBuckets : 0);
+		    auto lowBit = KmerKey::width<K>() - KmerKey::BITS_PER_RESIDUE * ksize;
+		    auto highBit = KmerKey::width<K>() - 8;
 
-            }
+		    tbb::parallel_for(size_t {0}, numBuckets, [&] (size_t bucket) {
+			    std::vector<PackedOcc<K>> occs;
+			    size_t numOccs {0};
 
-	        fseqs.shrink_to_fit();
-            return fseqs;
-        }
+			    for (const auto& buckets : localBuckets)
+				    numOccs += buckets[bucket].size();
 
-		static tbb::concurrent_vector<KmerOffset> uniqKmers(
-                const tbb::concurrent_vector<FastaSeq>& fseqs, uint32_t ksize) {
+			    if (numOccs == 0)
+				    return;
+
+			    occs.reserve(numOccs);
+
+			    for (auto& buckets : localBuckets) {
+				    occs.insert(occs.end(), buckets[bucket].cbegin(), buckets[bucket].cend());
+				    std::vector<PackedOcc<K>>().swap(buckets[bucket]);
+			    }
+
+			    std::vector<PackedOcc<K>> tmp;
+			    KmerKey::radixSort<K>(occs, tmp, lowBit, highBit);
+			    std::vector<PackedOcc<K>>().swap(tmp);
+
+			    auto& uniqs = bucketUniqs[bucket];
+			    size_t runBegin {0};
+
+			    for (size_t i = 0; i < occs.size(); ) {
+				    auto first = &occs[i];
+
+				    for (++i; i < occs.size() && occs[i].key == first->key; ++i) {
+					    if (occs[i].seqIdx < first->seqIdx ||
+							    (occs[i].seqIdx == first->seqIdx && occs[i].offset < first->offset))
+						    first = &occs[i];
+				    }
+
+				    uniqs.emplace_back(first->seqIdx, first->offset, ksize);
+				    uniqs.back().setCount(i - runBegin);
+
+				    if (occurrences != nullptr) {
+					    auto& kmerOccs = bucketOccs[bucket];
+					    kmerOccs.addKmer();
+					    kmerOccs.setRepresentative(first->seqIdx, first->offset);
+
+					    for (auto j = runBegin; j < i; ++j)
+						    kmerOccs.addOccurrence(occs[j].seqIdx, occs[j].offset);
+				    }
+
+				    runBegin = i;
+			    }
+		    });
+
+		    if (occurrences != nullptr)
+			    *occurrences = KmerOccurrences::concat(bucketOccs);
+
+		    return ThreadBuffers::concat(bucketUniqs);
+	    }
+
+	    // Every k-mer occurrence (enumerated by chunks of similar size, see "SeqChunks") is hashed
+	    // (rolling hash) and sent to one of the shards (by the hash's higher bits); then, every
+	    // shard is deduplicated on its own with an open-addressing table, verifying the collisions
+	    // against the sequences
+	    static std::vector<KmerOffset> uniqHashedKmers(
+			    const FastaSeqs& fseqs, uint32_t ksize, KmerOccurrences* occurrences) {
+
+			if (occurrences != nullptr)
+				*occurrences = KmerOccurrences();
 
 			auto total = totalKmers(fseqs, ksize);
 
 			if (total == 0)
-				return tbb::concurrent_vector<KmerOffset>();
+				return std::vector<KmerOffset>();
 
-			tbb::concurrent_vector<KmerOffset> totKmers;
-			totKmers.reserve(total);
+			// Enough shards to keep the tables of the shards small (and balanced among the threads)
+			uint shardBits {4};
 
-			tbb::parallel_for_each(fseqs.cbegin(), fseqs.cend(), [&] (const FastaSeq& fs) {
+			while (shardBits < 12 && (total >> shardBits) > (1u << 16))
+				++shardBits;
 
-				if (ksize > fs.length())
-					return;
+			auto numShards = size_t {1} << shardBits;
+			auto pow = KmerHash::power(ksize);
+
+			// Phase 1: hash every occurrence into the thread's local shards
+			tbb::enumerable_thread_specific<std::vector<std::vector<KmerOcc>>> localShards(
+					[numShards] { return std::vector<std::vector<KmerOcc>>(numShards); });
+
+			auto chunks = SeqChunks::split(fseqs, ksize);
+
+			tbb::parallel_for(size_t {0}, chunks.size(), [&] (size_t c) {
+				auto& shards = localShards.local();
+				const auto& chunk = chunks[c];
 
-				size_t startKmer {0};
-				size_t stopKmer {fs.length() - ksize + 1};
+				for (auto i = chunk.firstSeq; i < chunk.lastSeq; ++i) {
+					const auto& seq = fseqs[i];
+					auto starts = chunk.starts(seq.length(), ksize);
 
-				while (startKmer < stopKmer)
-					totKmers.emplace_back(fs, startKmer++, ksize);
+					if (starts.first == starts.second)
+						continue;
 
+					auto data = seq.data();
+					auto h = KmerHash::hash(data + starts.first, ksize);
+
+					for (auto offset = starts.first; offset < starts.second; ++offset) {
+						if (offset > starts.first)
+							h = KmerHash::roll(h, data[offset - 1], data[offset + ksize - 1], pow);
+
+						auto shard = KmerHash::mix(h) >> (64 - shardBits);
+						shards[shard].push_back(KmerOcc {h, static_cast<uint32_t>(i),
+						                                 static_cast<uint32_t>(offset)});
+					}
+				}
 			});
 
-			tbb::parallel_sort(totKmers);
-            auto lastUnique = std::unique(totKmers.begin(), totKmers.end());
-            auto totUniques = static_cast<size_t>(std::distance(totKmers.begin(), lastUnique));
+			// Phase 2: deduplicate every shard (in parallel) with its own open-addressing table
+			std::vector<std::vector<KmerOffset>> shardUniqs(numShards);
+			std::vector<KmerOccurrences> shardOccs(occurrences != nullptr ? numShards : 0);
 
-            tbb::concurrent_vector<KmerOffset> uniqKmers;
-            uniqKmers.reserve(totUniques);
+			tbb::parallel_for(size_t {0}, numShards, [&] (size_t shard) {
+				std::vector<KmerOcc> occs;
+				size_t numOccs {0};
 
-            tbb::parallel_for_each(totKmers.begin(), lastUnique, [&] (auto& koff) {
-                uniqKmers.emplace_back(koff);
-            });
+				for (const auto& shards : localShards)
+					numOccs += shards[shard].size();
 
-            totKmers.clear();
-            uniqKmers.shrink_to_fit();
+				if (numOccs == 0)
+					return;
 
-			return uniqKmers;
-		}
+				occs.reserve(numOccs);
 
-    private:
-        static bool isValid(const std::string& seq) {
-		    for (const auto& c : seq) {
-			    if (Globals::ALPHABET.find_first_of(c) == std::string::npos)
-				    return false;
-		    }
+				for (auto& shards : localShards) {
+					occs.insert(occs.end(), shards[shard].cbegin(), shards[shard].cend());
+					std::vector<KmerOcc>().swap(shards[shard]);
+				}
 
-            return true; // all OK
-        }
+				size_t capacity {16};
+
+				while (capacity < 2 * numOccs)
+					capacity <<= 1;
+
+				// Indexes (+1) of the occurrences in "occs", 0 is an empty slot, and number of
+				// occurrences of the k-mer of every slot
+				std::vector<uint32_t> table(capacity, 0);
+				std::vector<uint32_t> counts(capacity, 0);
+
+				// Slot of the k-mer of every occurrence (only for keeping the occurrences)
+				std::vector<uint32_t> slots(occurrences != nullptr ? occs.size() : 0);
+				size_t numUniqs {0};
+
+				auto kmerPtr = [&] (const KmerOcc& occ) {
+					return fseqs[occ.seqIdx].data() + occ.offset;
+				};
+
+				for (size_t i = 0; i < occs.size(); ++i) {
+					const auto& occ = occs[i];
+					auto slot = static_cast<size_t>(KmerHash::mix(occ.hash)) & (capacity - 1);
+
+					while (true) {
+						if (table[slot] == 0) {
+							table[slot] = static_cast<uint32_t>(i + 1);
+							counts[slot] = 1;
+							++numUniqs;
+
+							if (!slots.empty())
+								slots[i] = static_cast<uint32_t>(slot);
+
+							break;
+						}
+
+						auto& other = occs[table[slot] - 1];
+
+						if (other.hash == occ.hash && std::memcmp(kmerPtr(other), kmerPtr(occ), ksize) == 0) {
+							++counts[slot];
+
+							if (!slots.empty())
+								slots[i] = static_cast<uint32_t>(slot);
+
+							if (occ.seqIdx < other.seqIdx || (occ.seqIdx == other.seqIdx && occ.offset < other.offset))
+								table[slot] = static_cast<uint32_t>(i + 1);
+
+							break;
+						}
+
+						slot = (slot + 1) & (capacity - 1);
+					}
+				}
+
+				auto& uniqs = shardUniqs[shard];
+				uniqs.reserve(numUniqs);
+
+				for (size_t slot = 0; slot < capacity; ++slot) {
+					if (table[slot] == 0)
+						continue;
+
+					const auto& occ = occs[table[slot] - 1];
+					uniqs.emplace_back(occ.seqIdx, occ.offset, ksize);
+					uniqs.back().setCount(counts[slot]);
+				}
+
+				if (occurrences == nullptr)
+					return;
+
+				// Group the occurrences by slot (counting sort), in the same order as the k-mers
+				std::vector<size_t> firsts(capacity + 1, 0);
+
+				for (size_t slot = 0; slot < capacity; ++slot)
+					firsts[slot + 1] = firsts[slot] + (table[slot] == 0 ? 0 : counts[slot]);
+
+				std::vector<uint32_t> grouped(occs.size());
+				auto next = firsts;
+
+				for (size_t i = 0; i < occs.size(); ++i)
+					grouped[next[slots[i]]++] = static_cast<uint32_t>(i);
+
+				auto& kmerOccs = shardOccs[shard];
+
+				for (size_t slot = 0; slot < capacity; ++slot) {
+					if (table[slot] == 0)
+						continue;
+
+					const auto& rep = occs[table[slot] - 1];
+					kmerOccs.addKmer();
+					kmerOccs.setRepresentative(rep.seqIdx, rep.offset);
+
+					for (auto j = firsts[slot]; j < firsts[slot + 1]; ++j)
+						kmerOccs.addOccurrence(occs[grouped[j]].seqIdx, occs[grouped[j]].offset);
+				}
+			});
+
+			if (occurrences != nullptr)
+				*occurrences = KmerOccurrences::concat(shardOccs);
+
+			return ThreadBuffers::concat(shardUniqs);
+		}
 
-	    static size_t totalKmers(const tbb::concurrent_vector<FastaSeq>& fseqs, size_t ksize) {
+	    // Occurrence of a k-mer (hash, sequence and offset)
+	    struct KmerOcc {
+		    uint64_t hash;
+		    uint32_t seqIdx;
+		    uint32_t offset;
+	    };
+
+	    // Occurrence of a k-mer (packed key, sequence and offset)
+	    template<typename K>
+	    struct PackedOcc {
+		    K key;
+		    uint32_t seqIdx;
+		    uint32_t offset;
+	    };
+
+	    static size_t totalKmers(const FastaSeqs& fseqs, size_t ksize) {
 		    size_t total {0};
 
             std::for_each(fseqs.cbegin(), fseqs.cend(), [&total, &ksize] (const FastaSeq& fs) {
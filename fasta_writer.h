@@ -0,0 +1,251 @@
+#ifndef INPROT_FASTA_WRITER_H
+#define INPROT_FASTA_WRITER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <tbb/tbb.h>
+#include "fasta_seq.h"
+#include "kmer_offset.h"
+
+namespace fasta {
+
+	// Region [begin, end) of the sequence "seqIdx" to be written as a FASTA record, with the header
+	// ">desc_begin_last" (plus " count=N" if "count" > 0, or " count>=N" if it is saturated at
+	// "KmerOffset::MAX_COUNT")
+	struct FastaRecord {
+		size_t seqIdx;
+		size_t begin;
+		size_t end;
+		size_t count;
+	};
+
+	// Writer of regions of the sequences as FASTA records. The records are formatted in parallel, by
+	// blocks, into per-block buffers: the headers (and the short regions) are copied into the buffer,
+	// while the long regions are referenced in place, in the sequences. The blocks go through a
+	// pipeline that writes them in order, with large "writev" calls, so the output is the same as
+	// writing the records one by one.
+	class FastaWriter {
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		explicit FastaWriter(const FastaSeqs& fseqs): mFseqs(fseqs) { }
+		FastaWriter(const FastaWriter&) = delete;
+		FastaWriter& operator=(const FastaWriter&) = delete;
+
+		~FastaWriter() {
+			close();
+		}
+
+		//
+		// Methods
+		//
+		bool open(const std::string& filename, bool append = false) {
+			close();
+
+			mFd = ::open(filename.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+			mFailed = mFd < 0;
+
+			return !mFailed;
+		}
+
+		bool close() {
+			if (mFd >= 0) {
+				::close(mFd);
+				mFd = -1;
+			}
+
+			return !mFailed;
+		}
+
+		bool isOpen() const {
+			return mFd >= 0;
+		}
+
+		// Write the records "record(i)", for i in [0, numRecords), in order
+		template<typename F>
+		bool write(size_t numRecords, F&& record) {
+			if (mFd < 0)
+				return false;
+
+			size_t nextBlock {0};
+			auto numBlocks = (numRecords + BLOCK_RECORDS - 1) / BLOCK_RECORDS;
+
+			tbb::parallel_pipeline(MAX_BLOCKS,
+				tbb::make_filter<void, std::shared_ptr<Block>>(tbb::filter::serial_in_order,
+					[&] (tbb::flow_control& fc) -> std::shared_ptr<Block> {
+
+						if (nextBlock == numBlocks || mFailed) {
+							fc.stop();
+							return nullptr;
+						}
+
+						auto block = std::make_shared<Block>();
+						block->first = nextBlock * BLOCK_RECORDS;
+						block->last = std::min(numRecords, block->first + BLOCK_RECORDS);
+						++nextBlock;
+
+						return block;
+					}) &
+
+				tbb::make_filter<std::shared_ptr<Block>, std::shared_ptr<Block>>(tbb::filter::parallel,
+					[&] (std::shared_ptr<Block> block) {
+
+						for (auto i = block->first; i < block->last; ++i)
+							format(*block, record(i));
+
+						block->finish();
+						return block;
+					}) &
+
+				tbb::make_filter<std::shared_ptr<Block>, void>(tbb::filter::serial_in_order,
+					[&] (std::shared_ptr<Block> block) {
+
+						if (!mFailed)
+							writeBlock(*block);
+					})
+			);
+
+			return !mFailed;
+		}
+
+	private:
+		// Records formatted per block, blocks formatted (or waiting to be written) at a time and
+		// regions shorter than "MIN_REFERENCED" residues, which are copied instead of referenced
+		static constexpr size_t BLOCK_RECORDS = 16'384;
+		static constexpr size_t MAX_BLOCKS = 16;
+		static constexpr size_t MIN_REFERENCED = 256;
+
+		// Formatted records: pieces of "text" (ptr == nullptr, at "offset") or regions referenced in
+		// the sequences
+		struct Piece {
+			const char* ptr;
+			size_t offset;
+			size_t len;
+		};
+
+		struct Block {
+			size_t first;
+			size_t last;
+			std::string text;
+			std::vector<Piece> pieces;
+			size_t textBegin {0};   // Start of the piece of "text" not closed yet
+
+			void reference(const char* ptr, size_t len) {
+				closeText();
+				pieces.push_back(Piece {ptr, 0, len});
+			}
+
+			void finish() {
+				closeText();
+			}
+
+			void closeText() {
+				if (text.size() > textBegin)
+					pieces.push_back(Piece {nullptr, textBegin, text.size() - textBegin});
+
+				textBegin = text.size();
+			}
+		};
+
+		void format(Block& block, const FastaRecord& rec) const {
+			const auto& fs = mFseqs[rec.seqIdx];
+			auto& text = block.text;
+
+			text += '>';
+			text.append(fs.descData(), fs.descLength());
+			text += '_';
+			appendNumber(text, rec.begin);
+			text += '_';
+			appendNumber(text, rec.end > 0 ? rec.end - 1 : rec.end);
+
+			if (rec.count > 0) {
+				text += (rec.count >= KmerOffset::MAX_COUNT) ? " count>=" : " count=";
+				appendNumber(text, rec.count);
+			}
+
+			text += '\n';
+
+			auto len = rec.end - rec.begin;
+			auto region = fs.data() + rec.begin;
+
+			if (len >= MIN_REFERENCED)
+				block.reference(region, len);
+			else
+				text.append(region, len);
+
+			text += '\n';
+		}
+
+		static void appendNumber(std::string& text, size_t value) {
+			char digits[20];
+			auto end = digits + sizeof(digits);
+			auto ptr = end;
+
+			do {
+				*--ptr = static_cast<char>('0' + value % 10);
+				value /= 10;
+			} while (value > 0);
+
+			text.append(ptr, end);
+		}
+
+		void writeBlock(const Block& block) {
+			std::vector<iovec> iovs(block.pieces.size());
+
+			for (size_t i = 0; i < iovs.size(); ++i) {
+				const auto& piece = block.pieces[i];
+				auto ptr = (piece.ptr != nullptr) ? piece.ptr : block.text.data() + piece.offset;
+
+				iovs[i].iov_base = const_cast<char*>(ptr);
+				iovs[i].iov_len = piece.len;
+			}
+
+			auto iov = iovs.data();
+			auto remaining = iovs.size();
+
+			while (remaining > 0) {
+				auto count = static_cast<int>(std::min<size_t>(remaining, IOV_MAX));
+				auto written = ::writev(mFd, iov, count);
+
+				if (written <= 0) {
+					mFailed = true;
+					return;
+				}
+
+				// Skip the pieces fully written and adjust the partially written one
+				auto bytes = static_cast<size_t>(written);
+
+				while (remaining > 0 && bytes >= iov->iov_len) {
+					bytes -= iov->iov_len;
+					++iov;
+					--remaining;
+				}
+
+				if (remaining > 0) {
+					iov->iov_base = static_cast<char*>(iov->iov_base) + bytes;
+					iov->iov_len -= bytes;
+				}
+			}
+		}
+
+		//
+		// Fields
+		//
+		const FastaSeqs& mFseqs;
+		int mFd {-1};
+		std::atomic<bool> mFailed {false};
+
+	};
+
+}
+
+#endif //INPROT_FASTA_WRITER_H
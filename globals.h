@@ -14,7 +14,7 @@ namespace Globals {
     constexpr size_t     MIN_KMER_SIZE = 10;
     constexpr size_t     MAX_KMER_SIZE = 200;
     const std::string    ALPHABET = "ACDEFGHIKLMNPQRSTVWY"s;
-    constexpr size_t     NUM_MDS {51};
+    constexpr size_t     NUM_MDS {51};     // Number of MDs of the default descriptors set
 	constexpr int        PH_NET_CHARGE {9};
 	constexpr uint       HMM_ANGLE {100};
 	constexpr uint       HMM_WINDOW_SIZE {10};
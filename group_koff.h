@@ -5,30 +5,44 @@
 #ifndef INPROT_GROUP_KOFF_H
 #define INPROT_GROUP_KOFF_H
 
+#include <cstring>
+#include <algorithm>
 #include "fasta_seq.h"
+#include "kmer_hash.h"
 
 namespace fasta {
 
+    // Group of overlapped k-mers: the region [begin, end) of the sequence "seqIdx" (of the sequences
+    // table)
     class GroupKoff {
 
     public:
 
-        explicit GroupKoff(const FastaSeq& fs, size_t begin, size_t end): mFseq(fs), mBegin(begin), mEnd(end) { }
+        GroupKoff() = default;
+        explicit GroupKoff(const FastaSeqs& fseqs, size_t seqIdx, size_t begin, size_t end):
+                mHash(KmerHash::mix(KmerHash::hash(fseqs[seqIdx].data() + begin, end - begin) ^ (end - begin))),
+                mSeqIdx(static_cast<uint32_t>(seqIdx)), mBegin(static_cast<uint32_t>(begin)),
+                mEnd(static_cast<uint32_t>(end)) { }
 
-        bool operator<(const GroupKoff& rhs) const {
-            return getKmmer() < rhs.getKmmer();
+        // Groups are compared by their content (only the residues of the ones with the same hash)
+        bool equals(const FastaSeqs& fseqs, const GroupKoff& rhs) const {
+            if (mHash != rhs.mHash || mEnd - mBegin != rhs.mEnd - rhs.mBegin)
+                return false;
+
+            return std::memcmp(data(fseqs), rhs.data(fseqs), mEnd - mBegin) == 0;
         }
 
-        bool operator==(const GroupKoff& rhs) const {
-            return getKmmer() == rhs.getKmmer();
+        // Hash of the content (computed once, when the group is created)
+        uint64_t getHash() const {
+            return mHash;
         }
 
-        std::string getKmmer() const {
-            return mFseq.get().getSeq().substr(mBegin, mEnd - mBegin);
+        std::string getKmmer(const FastaSeqs& fseqs) const {
+            return std::string(data(fseqs), mEnd - mBegin);
         }
 
-        const FastaSeq& getFastaSeq() const {
-            return mFseq.get();
+        size_t getSeqIdx() const {
+            return mSeqIdx;
         }
 
         size_t getBegin() const {
@@ -40,9 +54,14 @@ namespace fasta {
         }
 
     private:
-        std::reference_wrapper<const FastaSeq> mFseq;
-        size_t mBegin;
-        size_t mEnd;
+        const char* data(const FastaSeqs& fseqs) const {
+            return fseqs[mSeqIdx].data() + mBegin;
+        }
+
+        uint64_t mHash;     // Hash of the content
+        uint32_t mSeqIdx;
+        uint32_t mBegin;
+        uint32_t mEnd;
 
     };
 
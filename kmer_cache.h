@@ -0,0 +1,347 @@
+#ifndef INPROT_KMER_CACHE_H
+#define INPROT_KMER_CACHE_H
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <valarray>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <tbb/tbb.h>
+#include <tbb/spin_mutex.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "globals.h"
+
+template <typename Condition>
+using EnableIf = typename std::enable_if<Condition::value>::type;
+
+namespace fasta {
+
+	// On-disk (memory-mapped) cache of molecular descriptors and SVM predictions, keyed by
+	// k-mer content. It is organized as a set-associative table: every k-mer maps to a set of
+	// "CACHE_WAYS" slots and, when the set is full, the slot least recently used (in number of
+	// runs) is evicted. The file size (the cap) is fixed when the cache is created.
+	//
+	// Descriptors only depend on the k-mer, but the predictions also depend on the SVM's
+	// model and scaling files, so the predictions are dropped when their checksum changes.
+	//
+	// The slots are only synchronized between the threads of a run, so the file is locked
+	// (exclusively) while it is open: a run that finds it locked by another one goes without cache.
+	template<typename T, EnableIf<std::is_floating_point<T>>...>
+	class KmerCache {
+
+		static constexpr uint64_t CACHE_MAGIC = 0x31434b544f52504eULL; // "NPROTKC1"
+		static constexpr uint32_t CACHE_VERSION = 2;
+		static constexpr size_t CACHE_WAYS = 8;
+		static constexpr size_t NUM_LOCKS = 4096;
+
+		struct Header {
+			uint64_t magic;
+			uint32_t version;
+			uint32_t numMds;
+			uint32_t mdSize;
+			uint32_t slotSize;
+			uint64_t numSlots;
+			uint64_t checksum;
+			uint64_t mdsChecksum;
+			uint64_t epoch;
+		};
+
+		// Fixed part of a slot. The descriptors (numMds values of type T) follow it
+		struct Slot {
+			uint64_t keyHi;
+			uint64_t keyLo;
+			uint32_t epoch;
+			uint8_t size;
+			int8_t label;       // 0 => no prediction cached
+			uint8_t used;
+			uint8_t hasMds;
+		};
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		KmerCache() = default;
+		KmerCache(const KmerCache&) = delete;
+		KmerCache& operator=(const KmerCache&) = delete;
+
+		~KmerCache() {
+			close();
+		}
+
+		//
+		// Methods
+		//
+		bool open(const std::string& filename, size_t maxBytes, uint64_t checksum,
+		          size_t numMds = Globals::NUM_MDS, uint64_t mdsChecksum = 0) {
+			close();
+
+			auto slotSize = (sizeof(Slot) + numMds * sizeof(T) + 7) & ~static_cast<size_t>(7);
+
+			if (maxBytes < sizeof(Header) + CACHE_WAYS * slotSize)
+				return false;
+
+			// Number of slots: greatest power of two that fits into the size cap
+			size_t numSlots {CACHE_WAYS};
+			while ((numSlots << 1) * slotSize + sizeof(Header) <= maxBytes)
+				numSlots <<= 1;
+
+			auto fileSize = sizeof(Header) + numSlots * slotSize;
+
+			mInUse = false;
+			mFd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+			if (mFd < 0)
+				return false;
+
+			if (flock(mFd, LOCK_EX | LOCK_NB) != 0) {
+				mInUse = errno == EWOULDBLOCK;
+				close();
+				return false;
+			}
+
+			struct stat st {};
+			if (fstat(mFd, &st) != 0) {
+				close();
+				return false;
+			}
+
+			bool reset = static_cast<size_t>(st.st_size) != fileSize;
+
+			if (reset && ftruncate(mFd, 0) != 0) {
+				close();
+				return false;
+			}
+
+			if (reset && ftruncate(mFd, static_cast<off_t>(fileSize)) != 0) {
+				close();
+				return false;
+			}
+
+			auto addr = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+
+			if (addr == MAP_FAILED) {
+				close();
+				return false;
+			}
+
+			mData = static_cast<char*>(addr);
+			mSize = fileSize;
+			mSlotSize = slotSize;
+			mNumSlots = numSlots;
+			mNumMds = numMds;
+
+			auto header = reinterpret_cast<Header*>(mData);
+
+			// A cache created with another layout (size cap, number or type of the descriptors) or
+			// another descriptors set can not be reused, then, start from scratch
+			if (reset || header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+					header->numMds != numMds || header->mdSize != sizeof(T) || header->slotSize != slotSize ||
+					header->numSlots != numSlots || header->mdsChecksum != mdsChecksum) {
+
+				std::memset(mData, 0, mSize);
+				header->magic = CACHE_MAGIC;
+				header->version = CACHE_VERSION;
+				header->numMds = static_cast<uint32_t>(numMds);
+				header->mdSize = sizeof(T);
+				header->slotSize = static_cast<uint32_t>(slotSize);
+				header->numSlots = numSlots;
+				header->checksum = checksum;
+				header->mdsChecksum = mdsChecksum;
+				header->epoch = 0;
+			}
+
+			// Different model or scaling => the cached predictions are no longer valid
+			if (header->checksum != checksum) {
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, mNumSlots), [&] (const auto& r) {
+					for (auto i = r.begin(); i != r.end(); ++i)
+						slotAt(i)->label = 0;
+				});
+
+				header->checksum = checksum;
+			}
+
+			mEpoch = static_cast<uint32_t>(++header->epoch);
+			mLocks = std::make_unique<tbb::spin_mutex[]>(NUM_LOCKS);
+
+			return true;
+		}
+
+		void close() {
+			if (mData != nullptr) {
+				msync(mData, mSize, MS_ASYNC);
+				munmap(mData, mSize);
+				mData = nullptr;
+			}
+
+			if (mFd >= 0) {
+				::close(mFd);
+				mFd = -1;
+			}
+		}
+
+		bool isOpen() const {
+			return mData != nullptr;
+		}
+
+		// Was the last "open" refused because the file is locked by another run?
+		bool isInUse() const {
+			return mInUse;
+		}
+
+		size_t getNumMds() const {
+			return mNumMds;
+		}
+
+		// Look for the given k-mer. Returns the cached label (0 if no prediction is cached) and
+		// copies the cached descriptors into "mds" (if any), setting "hasMds" accordingly
+		int lookup(const char* kmer, uint size, std::valarray<T>& mds, bool& hasMds) {
+			hasMds = false;
+			auto key = hashKmer(kmer, size);
+			auto set = setOf(key.second);
+			tbb::spin_mutex::scoped_lock lock(mLocks[set % NUM_LOCKS]);
+
+			for (size_t w = 0; w < CACHE_WAYS; ++w) {
+				auto slot = slotAt(set * CACHE_WAYS + w);
+
+				if (!matches(slot, key, size))
+					continue;
+
+				slot->epoch = mEpoch;
+
+				if (slot->hasMds && mds.size() == mNumMds) {
+					std::memcpy(&mds[0], mdsOf(slot), mNumMds * sizeof(T));
+					hasMds = true;
+				}
+
+				++mHits;
+				return slot->label;
+			}
+
+			++mMisses;
+			return 0;
+		}
+
+		// Insert (or update) the descriptors (not scaled) and the label of the given k-mer
+		void store(const char* kmer, uint size, const std::valarray<T>& mds, int label) {
+			auto key = hashKmer(kmer, size);
+			auto set = setOf(key.second);
+			tbb::spin_mutex::scoped_lock lock(mLocks[set % NUM_LOCKS]);
+
+			Slot* victim {nullptr};
+
+			for (size_t w = 0; w < CACHE_WAYS; ++w) {
+				auto slot = slotAt(set * CACHE_WAYS + w);
+
+				if (matches(slot, key, size)) {
+					victim = slot;
+					break;
+				}
+
+				// Prefer an empty slot, otherwise, evict the least recently used one
+				if (victim == nullptr || (victim->used && (!slot->used || slot->epoch < victim->epoch)))
+					victim = slot;
+			}
+
+			victim->keyHi = key.first;
+			victim->keyLo = key.second;
+			victim->size = static_cast<uint8_t>(size);
+			victim->label = static_cast<int8_t>(label);
+			victim->epoch = mEpoch;
+			victim->used = 1;
+			victim->hasMds = static_cast<uint8_t>(mds.size() == mNumMds);
+
+			if (victim->hasMds)
+				std::memcpy(mdsOf(victim), &mds[0], mNumMds * sizeof(T));
+		}
+
+		size_t getHits() const {
+			return mHits;
+		}
+
+		size_t getMisses() const {
+			return mMisses;
+		}
+
+		// FNV-1a checksum of a file's content (used for the SVM's model and scaling files)
+		static uint64_t fileChecksum(const std::string& filename, uint64_t seed = 0xcbf29ce484222325ULL) {
+			std::ifstream inFile(filename, std::ios_base::in | std::ios_base::binary);
+			std::vector<char> buffer(1 << 16);
+			uint64_t hash = seed;
+
+			while (inFile.read(buffer.data(), buffer.size()) || inFile.gcount() > 0) {
+				auto n = static_cast<size_t>(inFile.gcount());
+
+				for (size_t i = 0; i < n; ++i) {
+					hash ^= static_cast<unsigned char>(buffer[i]);
+					hash *= 0x100000001b3ULL;
+				}
+			}
+
+			return hash;
+		}
+
+
+	private:
+		//
+		// Private methods
+		//
+
+		// 128-bit key: two independent 64-bit hashes of the k-mer
+		static std::pair<uint64_t, uint64_t> hashKmer(const char* kmer, uint size) noexcept {
+			uint64_t h1 = 0xcbf29ce484222325ULL;
+			uint64_t h2 = 0x9e3779b97f4a7c15ULL ^ size;
+
+			for (uint i = 0; i < size; ++i) {
+				auto c = static_cast<unsigned char>(kmer[i]);
+				h1 = (h1 ^ c) * 0x100000001b3ULL;
+				h2 = (h2 + c) * 0xff51afd7ed558ccdULL;
+				h2 ^= h2 >> 29;
+			}
+
+			return std::make_pair(h1, h2 ^ (h2 >> 32));
+		}
+
+		size_t setOf(uint64_t keyLo) const noexcept {
+			return static_cast<size_t>(keyLo & (mNumSlots / CACHE_WAYS - 1));
+		}
+
+		bool matches(const Slot* slot, const std::pair<uint64_t, uint64_t>& key, uint size) const noexcept {
+			return slot->used && slot->size == size && slot->keyHi == key.first && slot->keyLo == key.second;
+		}
+
+		Slot* slotAt(size_t i) const noexcept {
+			return reinterpret_cast<Slot*>(mData + sizeof(Header) + i * mSlotSize);
+		}
+
+		T* mdsOf(Slot* slot) const noexcept {
+			return reinterpret_cast<T*>(reinterpret_cast<char*>(slot) + sizeof(Slot));
+		}
+
+		//
+		// Fields
+		//
+		int mFd {-1};
+		bool mInUse {false};
+		char* mData {nullptr};
+		size_t mSize {0};
+		size_t mSlotSize {0};
+		size_t mNumSlots {0};
+		size_t mNumMds {0};
+		uint32_t mEpoch {0};
+		std::unique_ptr<tbb::spin_mutex[]> mLocks;
+		std::atomic<size_t> mHits {0};
+		std::atomic<size_t> mMisses {0};
+
+	};
+
+}
+
+#endif //INPROT_KMER_CACHE_H
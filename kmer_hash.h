@@ -0,0 +1,78 @@
+#ifndef INPROT_KMER_HASH_H
+#define INPROT_KMER_HASH_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include "globals.h"
+
+namespace fasta {
+
+	// Hashing of k-mers by their residues' codes (1..20, following "Globals::ALPHABET").
+	class KmerHash {
+
+	public:
+		static constexpr uint64_t BASE = 0x100000001b3ULL;
+
+		// Code (1..20) of a residue, 0 if the residue is not in the alphabet
+		static uint8_t code(char c) noexcept {
+			return codes()[static_cast<unsigned char>(c)];
+		}
+
+		// Polynomial hash (mod 2^64) of the k-mer "kmer" of size "k"
+		static uint64_t hash(const char* kmer, size_t k) noexcept {
+			uint64_t h {0};
+
+			for (size_t i = 0; i < k; ++i)
+				h = h * BASE + code(kmer[i]);
+
+			return h;
+		}
+
+		// BASE^k (mod 2^64), needed for rolling the hash
+		static uint64_t power(size_t k) noexcept {
+			uint64_t p {1};
+
+			for (size_t i = 0; i < k; ++i)
+				p *= BASE;
+
+			return p;
+		}
+
+		// Hash of the next k-mer, given the hash "h" of the current one, the residue that leaves
+		// ("out"), the residue that enters ("in") and BASE^k ("pow")
+		static uint64_t roll(uint64_t h, char out, char in, uint64_t pow) noexcept {
+			return h * BASE + code(in) - code(out) * pow;
+		}
+
+		// Finalizer (from MurmurHash3): spreads the bits of a polynomial hash, whose lower bits are
+		// weak, for selecting shards and buckets
+		static uint64_t mix(uint64_t h) noexcept {
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+
+			return h;
+		}
+
+	private:
+		static const std::array<uint8_t, 256>& codes() noexcept {
+			static const std::array<uint8_t, 256> table = [] {
+				std::array<uint8_t, 256> t {};
+
+				for (size_t i = 0; i < Globals::ALPHABET.length(); ++i)
+					t[static_cast<unsigned char>(Globals::ALPHABET[i])] = static_cast<uint8_t>(i + 1);
+
+				return t;
+			}();
+
+			return table;
+		}
+
+	};
+
+}
+
+#endif //INPROT_KMER_HASH_H
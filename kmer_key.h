@@ -0,0 +1,98 @@
+#ifndef INPROT_KMER_KEY_H
+#define INPROT_KMER_KEY_H
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include "kmer_hash.h"
+
+namespace fasta {
+
+	// Packed keys of k-mers: 5 bits per residue (its code, 1..20), left-aligned. As the codes follow
+	// the (sorted) alphabet and 0 is only used as padding, the order of the keys is the
+	// lexicographic order of the k-mers (a k-mer is lower than its extensions), and two keys are
+	// equal only if the k-mers are equal. A 64-bit key holds up to 12 residues.
+	class KmerKey {
+
+	public:
+		static constexpr uint BITS_PER_RESIDUE = 5;
+
+		template<typename K>
+		static constexpr uint width() noexcept {
+			return static_cast<uint>(sizeof(K) * 8);
+		}
+
+		// Maximum k-mer size that fits a key of type "K"
+		template<typename K>
+		static constexpr uint maxSize() noexcept {
+			return width<K>() / BITS_PER_RESIDUE;
+		}
+
+		template<typename K>
+		static K pack(const char* kmer, size_t k) noexcept {
+			K key {0};
+
+			if (k == 0)
+				return key;
+
+			for (size_t i = 0; i < k; ++i)
+				key = (key << BITS_PER_RESIDUE) | KmerHash::code(kmer[i]);
+
+			return key << (width<K>() - BITS_PER_RESIDUE * k);
+		}
+
+		// Key of the next k-mer (of size "k"), given the key of the current one and the residue that
+		// enters ("in")
+		template<typename K>
+		static K roll(K key, char in, size_t k) noexcept {
+			return (key << BITS_PER_RESIDUE) |
+			       (static_cast<K>(KmerHash::code(in)) << (width<K>() - BITS_PER_RESIDUE * k));
+		}
+
+		// Higher 8 bits of the key, used for partitioning
+		template<typename K>
+		static uint8_t bucket(K key) noexcept {
+			return static_cast<uint8_t>(key >> (width<K>() - 8));
+		}
+
+		// LSD radix sort (8-bit digits) of the records "recs" by the bits [lowBit, highBit) of their
+		// "key" field; "tmp" is the auxiliary buffer
+		template<typename K, typename R>
+		static void radixSort(std::vector<R>& recs, std::vector<R>& tmp, uint lowBit, uint highBit) {
+			if (recs.size() < 2)
+				return;
+
+			tmp.resize(recs.size());
+
+			for (auto shift = lowBit; shift < highBit; shift += 8) {
+				std::array<size_t, 257> counts {};
+
+				for (const auto& rec : recs)
+					++counts[digit<K>(rec.key, shift) + 1];
+
+				// All the records have the same digit
+				if (std::find(counts.cbegin() + 1, counts.cend(), recs.size()) != counts.cend())
+					continue;
+
+				for (size_t i = 1; i < counts.size(); ++i)
+					counts[i] += counts[i - 1];
+
+				for (const auto& rec : recs)
+					tmp[counts[digit<K>(rec.key, shift)]++] = rec;
+
+				recs.swap(tmp);
+			}
+		}
+
+	private:
+		template<typename K>
+		static uint digit(K key, uint shift) noexcept {
+			return static_cast<uint>(key >> shift) & 0xff;
+		}
+
+	};
+
+}
+
+#endif //INPROT_KMER_KEY_H
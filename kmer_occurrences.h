@@ -0,0 +1,121 @@
+#ifndef INPROT_KMER_OCCURRENCES_H
+#define INPROT_KMER_OCCURRENCES_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <tbb/tbb.h>
+#include "kmer_offset.h"
+
+namespace fasta {
+
+	// Occurrences (sequence index and offset) of the unique k-mers of one size, kept while
+	// deduplicating them: the occurrences of every k-mer are stored contiguously (CSR layout) and
+	// found by the k-mer's representative (the occurrence kept as the unique k-mer), so the
+	// positions of a k-mer never have to be searched again.
+	class KmerOccurrences {
+
+	public:
+		struct Occurrence {
+			uint32_t seqIdx;
+			uint32_t offset;
+		};
+
+		//
+		// Methods
+		//
+
+		// Start the occurrences of a new k-mer (the following calls to "addOccurrence" belong to it)
+		void addKmer() {
+			mBegins.push_back(mOccs.size());
+		}
+
+		void addOccurrence(size_t seqIdx, size_t offset) {
+			mOccs.push_back(Occurrence {static_cast<uint32_t>(seqIdx), static_cast<uint32_t>(offset)});
+		}
+
+		// Set the representative of the last k-mer added
+		void setRepresentative(size_t seqIdx, size_t offset) {
+			mReps.resize(mBegins.size());
+			mReps.back() = Occurrence {static_cast<uint32_t>(seqIdx), static_cast<uint32_t>(offset)};
+		}
+
+		// Concatenate (in parallel) the occurrences collected independently (per block, per shard
+		// or per bucket) and index them by representative
+		static KmerOccurrences concat(std::vector<KmerOccurrences>& parts) {
+			KmerOccurrences all;
+			std::vector<size_t> kmerOffsets(parts.size() + 1, 0);
+			std::vector<size_t> occOffsets(parts.size() + 1, 0);
+
+			for (size_t i = 0; i < parts.size(); ++i) {
+				kmerOffsets[i + 1] = kmerOffsets[i] + parts[i].mBegins.size();
+				occOffsets[i + 1] = occOffsets[i] + parts[i].mOccs.size();
+			}
+
+			all.mReps.resize(kmerOffsets.back());
+			all.mBegins.resize(kmerOffsets.back() + 1);
+			all.mOccs.resize(occOffsets.back());
+			all.mBegins.back() = occOffsets.back();
+
+			tbb::parallel_for(size_t {0}, parts.size(), [&] (size_t i) {
+				auto& part = parts[i];
+
+				std::copy(part.mReps.cbegin(), part.mReps.cend(), all.mReps.begin() + kmerOffsets[i]);
+				std::copy(part.mOccs.cbegin(), part.mOccs.cend(), all.mOccs.begin() + occOffsets[i]);
+
+				for (size_t j = 0; j < part.mBegins.size(); ++j)
+					all.mBegins[kmerOffsets[i] + j] = part.mBegins[j] + occOffsets[i];
+
+				part = KmerOccurrences();
+			});
+
+			all.index();
+			return all;
+		}
+
+		// Occurrences of the unique k-mer "koff" (the [first, second) range), empty if "koff" is not
+		// the representative of any k-mer
+		std::pair<const Occurrence*, const Occurrence*> of(const KmerOffset& koff) const {
+			Occurrence rep {static_cast<uint32_t>(koff.getSeqIdx()), static_cast<uint32_t>(koff.getOffset())};
+
+			auto it = std::lower_bound(mOrder.cbegin(), mOrder.cend(), rep, [this] (uint32_t idx, const Occurrence& occ) {
+				return less(mReps[idx], occ);
+			});
+
+			if (it == mOrder.cend() || less(rep, mReps[*it]))
+				return std::make_pair(nullptr, nullptr);
+
+			return std::make_pair(mOccs.data() + mBegins[*it], mOccs.data() + mBegins[*it + 1]);
+		}
+
+		size_t size() const {
+			return mReps.size();
+		}
+
+	private:
+		static bool less(const Occurrence& lhs, const Occurrence& rhs) noexcept {
+			return (lhs.seqIdx != rhs.seqIdx) ? lhs.seqIdx < rhs.seqIdx : lhs.offset < rhs.offset;
+		}
+
+		// Order of the k-mers by representative (for the lookups)
+		void index() {
+			mOrder.resize(mReps.size());
+
+			for (size_t i = 0; i < mOrder.size(); ++i)
+				mOrder[i] = static_cast<uint32_t>(i);
+
+			tbb::parallel_sort(mOrder.begin(), mOrder.end(), [this] (uint32_t i, uint32_t j) {
+				return less(mReps[i], mReps[j]);
+			});
+		}
+
+		std::vector<Occurrence> mReps;      // Representative of every k-mer
+		std::vector<size_t> mBegins;        // First occurrence of every k-mer (plus the end, once indexed)
+		std::vector<Occurrence> mOccs;
+		std::vector<uint32_t> mOrder;
+
+	};
+
+}
+
+#endif //INPROT_KMER_OCCURRENCES_H
@@ -8,9 +8,13 @@
 #include "fasta_seq.h"
 #include "reduced_alphabets.h"
 #include "md.h"
+#include "md_set.h"
 #include <memory>
 #include <string>
+#include <limits>
+#include <algorithm>
 #include "svm_scaling.h"
+#include "kmer_cache.h"
 #include <tbb/tbb.h>
 
 #ifdef USE_LIBSVM
@@ -24,55 +28,57 @@ using namespace libsvm;
 
 namespace fasta {
 
+	// K-mer (occurrence) as the index of its sequence in the sequences table, its offset, its
+	// size and its number of occurrences (once deduplicated), packed in 12 bytes: the methods that
+	// need the residues take the sequences table
 	class KmerOffset {
 
 	public:
 		//
 		// Constructors & destructors
 		//
-		explicit KmerOffset(const FastaSeq& fseq, size_t offset, uint k, bool amp = false):
-				mFseq(fseq), mOffset(offset), mSize(k), mAmp(amp) { }
+		KmerOffset() = default;
+		explicit KmerOffset(size_t seqIdx, size_t offset, uint k, bool amp = false):
+				mSeqIdx(static_cast<uint32_t>(seqIdx)), mOffset(static_cast<uint32_t>(offset)),
+				mSize(static_cast<uint8_t>(k)), mFlags(amp ? AMP_FLAG : 0), mCount(1) { }
 
 
 		//
-		// Operators
+		// Methods
 		//
-		bool operator<(const KmerOffset& rhs) const {
-			return compare(rhs) < 0;
-		}
 
-		bool operator==(const KmerOffset& rhs) const {
-			return compare(rhs) == 0;
+		// Compare the content of the k-mers (of the sequences "fseqs")
+		int compare(const FastaSeqs& fseqs, const KmerOffset& rhs) const noexcept {
+			if (mSize < rhs.mSize)
+				return -1;
+			else if (mSize > rhs.mSize)
+				return 1;
+
+			return std::memcmp(data(fseqs), rhs.data(fseqs), mSize);
 		}
 
-		//
-		// Methods
-		//
 		uint size() const {
 			return mSize;
 		}
 
-		bool isConnected(const std::pair<size_t, size_t>& pair) {
-			return (pair.first < mOffset && pair.second == mOffset) || ((pair.second + 1) == mOffset);
-		}
+#ifdef USE_LIBSVM
+		template<typename T, EnableIf<std::is_floating_point<T>>...>
+		void evaluate(const FastaSeqs& fseqs, const SvmScaling<T>& scaling, const std::shared_ptr<svm_model>& model,
+		              const md::DescriptorSet<T>* mdset = nullptr, KmerCache<T>* cache = nullptr,
+		              T* mdsOut = nullptr) {
+			std::valarray<T> mds (mdset != nullptr ? mdset->size() : Globals::NUM_MDS);
 
-		bool intersect(const std::pair<size_t, size_t>& pair) {
-			auto end = getEnd();
+			auto cached = lookupCache(fseqs, cache, mds, mdsOut != nullptr, mdset);
 
-			if (pair.first <= mOffset && pair.second < end)
-				return mOffset <= pair.second && end >= pair.second;
+			// Copy out the descriptors (not scaled), e.g., for exporting them
+			if (mdsOut != nullptr)
+				std::copy(std::begin(mds), std::end(mds), mdsOut);
 
-			return pair.first >= mOffset && end <= pair.second;
-		}
+			if (cached)
+				return;
 
-		bool isInside(const std::pair<size_t, size_t>& pair) {
-			return mOffset >= pair.first && getEnd() <= pair.second;
-		}
-
-#ifdef USE_LIBSVM
-		template<typename T, EnableIf<std::is_floating_point<T>>...>
-		void evaluate(const SvmScaling<T>& scaling, const std::shared_ptr<svm_model>& model) {
-			std::valarray<T> mds = calculateMD<T>();
+			// Keep the descriptors not scaled for the cache
+			std::valarray<T> unscaled = (cache != nullptr) ? mds : std::valarray<T>();
 			scaling.scale(mds);
 
 			std::unique_ptr<svm_node[]> nodes = std::make_unique<svm_node[]>(mds.size() + 1);
@@ -85,35 +91,78 @@ namespace fasta {
 			nodes[mds.size()].index = -1;
 			nodes[mds.size()].value = std::numeric_limits<T>::max();
 
-			auto label = svm_predict(model.get(), nodes.get());
-			mAmp = static_cast<decltype(Globals::SVM_POSITIVE_LABEL)>(label) == Globals::SVM_POSITIVE_LABEL;
+			auto label = static_cast<decltype(Globals::SVM_POSITIVE_LABEL)>(svm_predict(model.get(), nodes.get()));
+			setAMP(label == Globals::SVM_POSITIVE_LABEL);
+
+			if (cache != nullptr)
+				cache->store(data(fseqs), mSize, unscaled, label);
 		}
 
 #else
 		template<typename T, EnableIf<std::is_floating_point<T>>...>
-		void evaluate(SvmScaling<T>& scaling, SvmModel<T>& model) {
-			std::valarray<T> mds = calculateMD<T>();
+		void evaluate(const FastaSeqs& fseqs, SvmScaling<T>& scaling, SvmModel<T>& model,
+		              const md::DescriptorSet<T>* mdset = nullptr, KmerCache<T>* cache = nullptr,
+		              T* mdsOut = nullptr) {
+			std::valarray<T> mds (mdset != nullptr ? mdset->size() : Globals::NUM_MDS);
+
+			auto cached = lookupCache(fseqs, cache, mds, mdsOut != nullptr, mdset);
+
+			// Copy out the descriptors (not scaled), e.g., for exporting them
+			if (mdsOut != nullptr)
+				std::copy(std::begin(mds), std::end(mds), mdsOut);
+
+			if (cached)
+				return;
+
+			// Keep the descriptors not scaled for the cache
+			std::valarray<T> unscaled = (cache != nullptr) ? mds : std::valarray<T>();
 			scaling.scale(mds);
 			auto ll = model.predict(mds);
 
-			mAmp = (ll == Globals::SVM_POSITIVE_LABEL);
+			setAMP(ll == Globals::SVM_POSITIVE_LABEL);
+
+			if (cache != nullptr)
+				cache->store(data(fseqs), mSize, unscaled, ll);
 		}
 #endif
 
 
+		// Molecular descriptors (not scaled) of the k-mer, calculated with the given descriptors
+		// set (or the hardcoded 51 descriptors if none)
+		template<typename T, EnableIf<std::is_floating_point<T>>...>
+		std::valarray<T> descriptors(const FastaSeqs& fseqs, const md::DescriptorSet<T>* mdset = nullptr) const {
+			if (mdset == nullptr)
+				return calculateMD<T>(fseqs);
+
+			std::valarray<T> mds (mdset->size());
+			mdset->calculate(data(fseqs), mSize, &mds[0]);
+
+			return mds;
+		}
+
+
 		//
 		// Getters & setters
 		//
-		const FastaSeq& getFastaSeq() const {
-			return mFseq.get();
+		size_t getSeqIdx() const {
+			return mSeqIdx;
 		}
 
-		const std::string getKmer() const {
-			return mFseq.get().getSeq().substr(mOffset, mSize);
+		// Pointer to the first residue of the k-mer (in its sequence of "fseqs")
+		const char* data(const FastaSeqs& fseqs) const {
+			return fseqs[mSeqIdx].data() + mOffset;
+		}
+
+		const std::string getKmer(const FastaSeqs& fseqs) const {
+			return std::string(data(fseqs), mSize);
 		}
 
 		bool isAMP() const {
-			return mAmp;
+			return (mFlags & AMP_FLAG) != 0;
+		}
+
+		void setAMP(bool amp) {
+			mFlags = static_cast<uint8_t>(amp ? (mFlags | AMP_FLAG) : (mFlags & ~AMP_FLAG));
 		}
 
 		size_t getOffset() const {
@@ -125,9 +174,24 @@ namespace fasta {
 		}
 
 		size_t getEnd() const {
-			return mOffset + mSize;
+			return static_cast<size_t>(mOffset) + mSize;
+		}
+
+		// Number of occurrences of the k-mer in the sequences (saturated at MAX_COUNT)
+		size_t getCount() const {
+			return mCount;
+		}
+
+		void setCount(size_t count) {
+			mCount = static_cast<uint16_t>(std::min<size_t>(count, MAX_COUNT));
+		}
+
+		void addCount(size_t count) {
+			setCount(mCount + count);
 		}
 
+		static constexpr size_t MAX_COUNT = std::numeric_limits<uint16_t>::max();
+
 
 
 	private:
@@ -135,24 +199,36 @@ namespace fasta {
 		//
 		// Private methods
 		//
-		int compare(const KmerOffset& rhs) const noexcept {
-			if (this == &rhs)
-				return 0;
+		// Consult the cache (if any) before calculating the molecular descriptors. Returns true
+		// if the prediction was found. Otherwise (or if "needMds" is set), "mds" holds the
+		// descriptors (not scaled)
+		template<typename T, EnableIf<std::is_floating_point<T>>...>
+		bool lookupCache(const FastaSeqs& fseqs, KmerCache<T>* cache, std::valarray<T>& mds, bool needMds,
+		                 const md::DescriptorSet<T>* mdset) {
+			if (cache == nullptr) {
+				mds = descriptors(fseqs, mdset);
+				return false;
+			}
 
-			if (mSize < rhs.mSize)
-				return -1;
-			else if (mSize > rhs.mSize)
-				return 1;
+			bool hasMds {false};
+			auto label = cache->lookup(data(fseqs), mSize, mds, hasMds);
+
+			if (!hasMds && (label == 0 || needMds))
+				mds = descriptors(fseqs, mdset);
+
+			if (label != 0) {
+				setAMP(label == Globals::SVM_POSITIVE_LABEL);
+				return true;
+			}
 
-			return std::memcmp(&mFseq.get().getSeq().at(mOffset),
-			                   &rhs.mFseq.get().getSeq().at(rhs.mOffset), mSize);
+			return false;
 		}
 
 		template<typename T, EnableIf<std::is_floating_point<T>>...>
-		std::valarray<T> calculateMD() noexcept {
+		std::valarray<T> calculateMD(const FastaSeqs& fseqs) const noexcept {
 
 			std::valarray<T> mds (Globals::NUM_MDS);
-			const auto& seq = getKmer();
+			const auto& seq = getKmer(fseqs);
 
 
 			//
@@ -401,13 +477,18 @@ namespace fasta {
 		//
 		// Fields
 		//
-		std::reference_wrapper<const FastaSeq> mFseq;
-		size_t mOffset;
-		uint mSize;
-		bool mAmp;
+		static constexpr uint8_t AMP_FLAG = 0x01;
+
+		uint32_t mSeqIdx;   // Index of the sequence in the sequences table ("FastaSeqs")
+		uint32_t mOffset;
+		uint8_t mSize;
+		uint8_t mFlags;
+		uint16_t mCount;
 
 	};
 
+	static_assert(sizeof(KmerOffset) == 12, "KmerOffset must be packed in 12 bytes");
+
 }
 
 
@@ -0,0 +1,347 @@
+#ifndef INPROT_KMER_PARTITIONS_H
+#define INPROT_KMER_PARTITIONS_H
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <tbb/tbb.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "fasta_seq.h"
+#include "kmer_hash.h"
+#include "kmer_key.h"
+#include "kmer_offset.h"
+#include "seq_chunks.h"
+#include "kmer_occurrences.h"
+
+namespace fasta {
+
+	// Run of consecutive start offsets of a sequence, [begin, end), whose k-mers share the same
+	// minimizer (super-k-mer)
+	struct SuperKmer {
+		uint32_t seqIdx;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	// External-memory partitioning of the k-mers: every start offset is routed, by the minimizer of
+	// its "lowerKSize"-mer, to one of the on-disk buckets (as part of a super-k-mer). As the k-mers
+	// of any size >= "lowerKSize" that start at an offset share the prefix the minimizer comes from,
+	// all the occurrences of a k-mer land in the same bucket, so every bucket is deduplicated on
+	// its own (and only one bucket has to be in memory at a time).
+	class KmerPartitions {
+
+	public:
+		static constexpr uint MINIMIZER_SIZE = 7;
+		// Every bucket keeps its file open while partitioning, so they stay well below the usual
+		// limit of open files (1024)
+		static constexpr size_t MAX_BUCKETS = 512;
+
+		//
+		// Constructors & destructors
+		//
+		KmerPartitions(const FastaSeqs& fseqs, uint lowerKSize, size_t numBuckets, const std::string& basename):
+				mFseqs(fseqs), mLowerKSize(lowerKSize), mFileNames(std::max<size_t>(1, numBuckets)) {
+
+			for (size_t b = 0; b < mFileNames.size(); ++b)
+				mFileNames[b] = "bucket_" + std::to_string(b) + "_" + basename;
+		}
+
+		~KmerPartitions() {
+			std::for_each(mFileNames.cbegin(), mFileNames.cend(), [] (const auto& fname) {
+				std::remove(fname.c_str());
+			});
+		}
+
+		//
+		// Methods
+		//
+
+		// Enough buckets for the k-mers of a bucket (of any size in [lower, upper]) to be
+		// deduplicated and evaluated within "memLimit" bytes
+		static size_t numBuckets(const FastaSeqs& fseqs, uint lowerKSize, size_t memLimit) {
+			size_t starts {0};
+
+			for (const auto& fs : fseqs)
+				starts += (fs.length() < lowerKSize) ? 0 : fs.length() - lowerKSize + 1;
+
+			auto bytes = starts * BYTES_PER_START;
+			auto buckets = (bytes + memLimit - 1) / std::max<size_t>(1, memLimit);
+
+			return std::min(std::max<size_t>(1, buckets), MAX_BUCKETS);
+		}
+
+		// Write the super-k-mers of the sequences to the buckets' files
+		std::pair<bool, std::string> partition() {
+			auto numBuckets = mFileNames.size();
+
+			// The files are created (or truncated) and kept open for the whole pass, while the threads
+			// append to them
+			std::vector<int> fds(numBuckets, -1);
+
+			auto closeAll = [&fds] {
+				for (auto fd : fds) {
+					if (fd >= 0)
+						::close(fd);
+				}
+			};
+
+			for (size_t b = 0; b < numBuckets; ++b) {
+				fds[b] = ::open(mFileNames[b].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+				if (fds[b] < 0) {
+					closeAll();
+					return std::make_pair(false, "Failed to open file: " + mFileNames[b]);
+				}
+			}
+
+			std::vector<std::mutex> mutexes(numBuckets);
+			std::atomic<bool> allOK {true};
+
+			tbb::enumerable_thread_specific<std::vector<std::vector<SuperKmer>>> localBuffers(
+					[numBuckets] { return std::vector<std::vector<SuperKmer>>(numBuckets); });
+
+			auto flush = [&] (size_t bucket, std::vector<SuperKmer>& buffer) {
+				std::lock_guard<std::mutex> lock(mutexes[bucket]);
+				auto data = reinterpret_cast<const char*>(buffer.data());
+				auto remaining = buffer.size() * sizeof(SuperKmer);
+
+				while (remaining > 0) {
+					auto written = ::write(fds[bucket], data, remaining);
+
+					if (written <= 0) {
+						allOK = false;
+						break;
+					}
+
+					data += written;
+					remaining -= static_cast<size_t>(written);
+				}
+
+				buffer.clear();
+			};
+
+			auto chunks = SeqChunks::split(mFseqs, mLowerKSize);
+
+			tbb::parallel_for(size_t {0}, chunks.size(), [&] (size_t c) {
+				auto& buffers = localBuffers.local();
+				const auto& chunk = chunks[c];
+
+				for (auto i = chunk.firstSeq; i < chunk.lastSeq; ++i) {
+					superKmers(i, chunk.starts(mFseqs[i].length(), mLowerKSize), [&] (uint64_t minimizer,
+					                                                                  const SuperKmer& skmer) {
+						auto bucket = minimizer % numBuckets;
+						auto& buffer = buffers[bucket];
+
+						buffer.push_back(skmer);
+
+						if (buffer.size() >= BUFFER_SIZE)
+							flush(bucket, buffer);
+					});
+				}
+			});
+
+			for (auto& buffers : localBuffers) {
+				for (size_t b = 0; b < numBuckets; ++b) {
+					if (!buffers[b].empty())
+						flush(b, buffers[b]);
+				}
+			}
+
+			closeAll();
+
+			if (!allOK)
+				return std::make_pair(false, "Error while writing the k-mers' buckets");
+
+			return std::make_pair(true, std::string());
+		}
+
+		// Load (into "skmers") the super-k-mers of the bucket "bucket"
+		std::pair<bool, std::string> load(size_t bucket, std::vector<SuperKmer>& skmers) const {
+			const auto& fname = mFileNames[bucket];
+			std::ifstream fin(fname, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+			skmers.clear();
+
+			if (!fin)
+				return std::make_pair(false, "Failed to open file: " + fname);
+
+			auto bytes = static_cast<size_t>(fin.tellg());
+			skmers.resize(bytes / sizeof(SuperKmer));
+
+			auto expected = static_cast<std::streamsize>(skmers.size() * sizeof(SuperKmer));
+
+			fin.seekg(0);
+			fin.read(reinterpret_cast<char*>(skmers.data()), expected);
+
+			if (fin.gcount() != expected || bytes % sizeof(SuperKmer) != 0) {
+				skmers.clear();
+				return std::make_pair(false, "Error while reading the k-mers' bucket: " + fname);
+			}
+
+			return std::make_pair(true, std::string());
+		}
+
+		// Unique k-mers of size "ksize" among the super-k-mers of a bucket; the representative of
+		// every k-mer is its lowest occurrence (by sequence index and offset), with the number of
+		// occurrences of the k-mer (kept in "occurrences", if given)
+		std::vector<KmerOffset> uniqKmers(const std::vector<SuperKmer>& skmers, uint ksize,
+		                                  KmerOccurrences* occurrences = nullptr) const {
+
+			// Occurrences of the k-mers (of size "ksize") of every super-k-mer
+			std::vector<size_t> offsets(skmers.size() + 1, 0);
+
+			for (size_t i = 0; i < skmers.size(); ++i)
+				offsets[i + 1] = offsets[i] + numStarts(skmers[i], ksize);
+
+			std::vector<KmerOcc> occs(offsets.back());
+			auto pow = KmerHash::power(ksize);
+
+			tbb::parallel_for(size_t {0}, skmers.size(), [&] (size_t i) {
+				const auto& skmer = skmers[i];
+				auto data = mFseqs[skmer.seqIdx].data();
+				auto stop = skmer.begin + numStarts(skmer, ksize);
+				auto h = KmerHash::hash(data + skmer.begin, ksize);
+
+				for (auto offset = skmer.begin; offset < stop; ++offset) {
+					if (offset > skmer.begin)
+						h = KmerHash::roll(h, data[offset - 1], data[offset + ksize - 1], pow);
+
+					occs[offsets[i] + offset - skmer.begin] = KmerOcc {KmerHash::mix(h), skmer.seqIdx, offset};
+				}
+			});
+
+			// Equal k-mers end up together, their lowest occurrence first
+			tbb::parallel_sort(occs.begin(), occs.end(), [&] (const KmerOcc& oi, const KmerOcc& oj) {
+				if (oi.hash != oj.hash)
+					return oi.hash < oj.hash;
+
+				auto cmp = std::memcmp(data(oi), data(oj), ksize);
+
+				if (cmp != 0)
+					return cmp < 0;
+
+				return (oi.seqIdx != oj.seqIdx) ? oi.seqIdx < oj.seqIdx : oi.offset < oj.offset;
+			});
+
+			std::vector<KmerOffset> kmers;
+			std::vector<KmerOccurrences> kmerOccs(occurrences != nullptr ? 1 : 0);
+
+			for (size_t i = 0; i < occs.size(); ++i) {
+				if (i == 0 || occs[i].hash != occs[i - 1].hash ||
+				    std::memcmp(data(occs[i]), data(occs[i - 1]), ksize) != 0) {
+					kmers.emplace_back(occs[i].seqIdx, occs[i].offset, ksize);
+
+					if (occurrences != nullptr) {
+						kmerOccs[0].addKmer();
+						kmerOccs[0].setRepresentative(occs[i].seqIdx, occs[i].offset);
+					}
+				} else {
+					kmers.back().addCount(1);
+				}
+
+				if (occurrences != nullptr)
+					kmerOccs[0].addOccurrence(occs[i].seqIdx, occs[i].offset);
+			}
+
+			if (occurrences != nullptr)
+				*occurrences = KmerOccurrences::concat(kmerOccs);
+
+			return kmers;
+		}
+
+		size_t size() const {
+			return mFileNames.size();
+		}
+
+	private:
+		// Approximate memory needed per start offset (occurrence, its sorting and the evaluated k-mer)
+		static constexpr size_t BYTES_PER_START = 48;
+		// Super-k-mers buffered (per thread and bucket) before being appended to the bucket's file
+		static constexpr size_t BUFFER_SIZE = 1'024;
+
+		struct KmerOcc {
+			uint64_t hash;
+			uint32_t seqIdx;
+			uint32_t offset;
+		};
+
+		const char* data(const KmerOcc& occ) const {
+			return mFseqs[occ.seqIdx].data() + occ.offset;
+		}
+
+		// Number of k-mers of size "ksize" that start in the super-k-mer
+		size_t numStarts(const SuperKmer& skmer, uint ksize) const {
+			auto len = mFseqs[skmer.seqIdx].length();
+
+			if (ksize > len || skmer.begin > len - ksize)
+				return 0;
+
+			return std::min<size_t>(skmer.end, len - ksize + 1) - skmer.begin;
+		}
+
+		// Split the start offsets [starts.first, starts.second) of the sequence "seqIdx" into
+		// super-k-mers, calling "emit" with the minimizer (the lowest hashed "MINIMIZER_SIZE"-mer of
+		// the "lowerKSize"-mer) of each one
+		template<typename F>
+		void superKmers(size_t seqIdx, std::pair<size_t, size_t> starts, F&& emit) const {
+			if (starts.first == starts.second)
+				return;
+
+			auto data = mFseqs[seqIdx].data();
+			auto window = mLowerKSize - MINIMIZER_SIZE + 1;
+
+			// Candidates (hash, position) of the sliding window, with increasing hashes
+			std::deque<std::pair<uint64_t, size_t>> candidates;
+			auto key = KmerKey::pack<uint64_t>(data + starts.first, MINIMIZER_SIZE);
+			auto next = starts.first;
+
+			SuperKmer skmer {static_cast<uint32_t>(seqIdx), static_cast<uint32_t>(starts.first), 0};
+			uint64_t minimizer {0};
+
+			for (auto start = starts.first; start < starts.second; ++start) {
+				for (; next < start + window; ++next) {
+					if (next > starts.first)
+						key = KmerKey::roll(key, data[next + MINIMIZER_SIZE - 1], MINIMIZER_SIZE);
+
+					auto h = KmerHash::mix(key);
+
+					while (!candidates.empty() && candidates.back().first >= h)
+						candidates.pop_back();
+
+					candidates.emplace_back(h, next);
+				}
+
+				while (candidates.front().second < start)
+					candidates.pop_front();
+
+				if (start == starts.first) {
+					minimizer = candidates.front().first;
+				} else if (candidates.front().first != minimizer) {
+					skmer.end = static_cast<uint32_t>(start);
+					emit(minimizer, skmer);
+
+					skmer.begin = static_cast<uint32_t>(start);
+					minimizer = candidates.front().first;
+				}
+			}
+
+			skmer.end = static_cast<uint32_t>(starts.second);
+			emit(minimizer, skmer);
+		}
+
+		const FastaSeqs& mFseqs;
+		uint mLowerKSize;
+		std::vector<std::string> mFileNames;
+
+	};
+
+}
+
+#endif //INPROT_KMER_PARTITIONS_H
@@ -0,0 +1,162 @@
+#ifndef INPROT_KMER_SCANNER_H
+#define INPROT_KMER_SCANNER_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <tbb/tbb.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "fasta_seq.h"
+#include "kmer_hash.h"
+#include "kmer_offset.h"
+#include "seq_chunks.h"
+#include "thread_buffers.h"
+
+namespace fasta {
+
+	// Multi-pattern scanner of k-mers: the patterns (k-mers of the sequences "fseqs", of any sizes)
+	// are put in one open-addressing table per size, keyed by their hashes, so a sequence is scanned
+	// in a single pass per size (rolling the hash) that reports every occurrence of every pattern.
+	class KmerScanner {
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		KmerScanner(const FastaSeqs& fseqs, const std::vector<KmerOffset>& patterns): mFseqs(fseqs) {
+			std::vector<uint> sizes;
+
+			for (const auto& koff : patterns)
+				sizes.push_back(koff.getSize());
+
+			std::sort(sizes.begin(), sizes.end());
+			sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+			mTables.resize(sizes.size());
+
+			tbb::parallel_for(size_t {0}, sizes.size(), [&] (size_t i) {
+				build(mTables[i], sizes[i], patterns);
+			});
+		}
+
+		//
+		// Methods
+		//
+
+		// Scan the sequence "seq" (of length "len"), calling "onMatch(offset, ksize)" for every
+		// occurrence of a pattern whose start is in [begin, end)
+		template<typename F>
+		void scan(const char* seq, size_t len, size_t begin, size_t end, F&& onMatch) const {
+			for (const auto& table : mTables) {
+				auto ksize = table.ksize;
+
+				if (ksize > len)
+					continue;
+
+				auto stop = std::min(end, len - ksize + 1);
+
+				if (begin >= stop)
+					continue;
+
+				auto h = KmerHash::hash(seq + begin, ksize);
+
+				for (auto offset = begin; offset < stop; ++offset) {
+					if (offset > begin)
+						h = KmerHash::roll(h, seq[offset - 1], seq[offset + ksize - 1], table.pow);
+
+					if (table.contains(mFseqs, h, seq + offset))
+						onMatch(offset, ksize);
+				}
+			}
+		}
+
+		// All the occurrences (in parallel, by chunks of the sequences) of the patterns in the
+		// sequences "seqs", as AMP k-mers
+		std::vector<KmerOffset> occurrences(const FastaSeqs& seqs) const {
+			if (mTables.empty())
+				return std::vector<KmerOffset>();
+
+			tbb::enumerable_thread_specific<std::vector<KmerOffset>> localOccs;
+			auto chunks = SeqChunks::split(seqs, mTables.front().ksize);
+
+			tbb::parallel_for(size_t {0}, chunks.size(), [&] (size_t c) {
+				auto& occs = localOccs.local();
+				const auto& chunk = chunks[c];
+
+				for (auto i = chunk.firstSeq; i < chunk.lastSeq; ++i) {
+					const auto& seq = seqs[i];
+
+					scan(seq.data(), seq.length(), chunk.begin, chunk.end, [&] (size_t offset, uint ksize) {
+						occs.emplace_back(i, offset, ksize, true);
+					});
+				}
+			});
+
+			return ThreadBuffers::concat(localOccs);
+		}
+
+	private:
+		// Patterns of one size: "slots" holds the indexes (+1) of the patterns (0 is an empty
+		// slot) and "hashes" their hashes
+		struct SizeTable {
+			uint ksize {0};
+			uint64_t pow {1};
+			size_t mask {0};
+			std::vector<uint32_t> slots;
+			std::vector<uint64_t> hashes;
+			std::vector<KmerOffset> patterns;
+
+			bool contains(const FastaSeqs& fseqs, uint64_t h, const char* kmer) const {
+				for (auto slot = static_cast<size_t>(KmerHash::mix(h)) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+					if (hashes[slot] == h && std::memcmp(patterns[slots[slot] - 1].data(fseqs), kmer, ksize) == 0)
+						return true;
+				}
+
+				return false;
+			}
+		};
+
+		void build(SizeTable& table, uint ksize, const std::vector<KmerOffset>& patterns) const {
+			table.ksize = ksize;
+			table.pow = KmerHash::power(ksize);
+
+			for (const auto& koff : patterns) {
+				if (koff.getSize() == ksize)
+					table.patterns.push_back(koff);
+			}
+
+			size_t capacity {16};
+
+			while (capacity < 2 * table.patterns.size())
+				capacity <<= 1;
+
+			table.mask = capacity - 1;
+			table.slots.assign(capacity, 0);
+			table.hashes.assign(capacity, 0);
+
+			for (size_t i = 0; i < table.patterns.size(); ++i) {
+				auto kmer = table.patterns[i].data(mFseqs);
+				auto h = KmerHash::hash(kmer, ksize);
+
+				// The same k-mer could be given more than once
+				if (table.contains(mFseqs, h, kmer))
+					continue;
+
+				auto slot = static_cast<size_t>(KmerHash::mix(h)) & table.mask;
+
+				while (table.slots[slot] != 0)
+					slot = (slot + 1) & table.mask;
+
+				table.slots[slot] = static_cast<uint32_t>(i + 1);
+				table.hashes[slot] = h;
+			}
+		}
+
+		const FastaSeqs& mFseqs;
+		std::vector<SizeTable> mTables;     // One per size, by increasing size
+
+	};
+
+}
+
+#endif //INPROT_KMER_SCANNER_H
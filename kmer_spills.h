@@ -0,0 +1,236 @@
+#ifndef INPROT_KMER_SPILLS_H
+#define INPROT_KMER_SPILLS_H
+
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <tbb/tbb.h>
+#include "kmer_offset.h"
+
+namespace fasta {
+
+	// Occurrence of an AMP k-mer (its size is the one of the spill file) in the binary spill files
+	struct SpillRecord {
+		uint32_t seqIdx;
+		uint32_t offset;
+	};
+
+	// Occurrences of the AMP k-mers, kept in runs of records sorted by sequence: the runs are kept
+	// in memory while they fit in the memory budget and the rest are spilled (appended) to a binary
+	// file per k-mer size. All the runs are merged (k-way, by sequence index) in a single sequential
+	// pass over the memory-mapped files, and the occurrences of the sequences are handed over
+	// window by window, without having them all in memory.
+	class KmerSpills {
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		KmerSpills() = default;
+		KmerSpills(const KmerSpills&) = delete;
+		KmerSpills& operator=(const KmerSpills&) = delete;
+
+		~KmerSpills() {
+			remove();
+		}
+
+		//
+		// Methods
+		//
+
+		// Prepare the runs of the k-mer sizes [lowerKSize, upperKSize], keeping up to "memBudget"
+		// bytes of them in memory (the spill files are created when needed)
+		void open(uint lowerKSize, uint upperKSize, const std::string& basename,
+		          size_t memBudget = std::numeric_limits<size_t>::max()) {
+			remove();
+
+			mLowerKSize = lowerKSize;
+			mMemBudget = memBudget;
+			mMemBytes = 0;
+			mFileNames.resize(upperKSize - lowerKSize + 1);
+			mFileRecords.assign(mFileNames.size(), 0);
+
+			for (auto ksize = lowerKSize; ksize <= upperKSize; ++ksize)
+				mFileNames[ksize - lowerKSize] = std::to_string(ksize) + "_" + basename;
+		}
+
+		// Will a run of "numRecords" records be kept in memory?
+		bool fits(size_t numRecords) const {
+			return numRecords * sizeof(SpillRecord) <= mMemBudget - mMemBytes;
+		}
+
+		// Sort (by sequence) the occurrences of the k-mers of size "ksize" and keep them as a new
+		// run: in memory, if it fits, or appended to their file
+		std::pair<bool, std::string> write(uint ksize, std::vector<SpillRecord>& records) {
+			if (records.empty())
+				return std::make_pair(true, std::string());
+
+			tbb::parallel_sort(records.begin(), records.end(), [] (const auto& ri, const auto& rj) {
+				return (ri.seqIdx != rj.seqIdx) ? ri.seqIdx < rj.seqIdx : ri.offset < rj.offset;
+			});
+
+			auto file = ksize - mLowerKSize;
+
+			if (fits(records.size())) {
+				mMemBytes += records.size() * sizeof(SpillRecord);
+				mRuns.push_back(Run {file, mMemRuns.size(), records.size(), true});
+				mMemRuns.push_back(std::move(records));
+
+				return std::make_pair(true, std::string());
+			}
+
+			const auto& fname = mFileNames[file];
+			std::ofstream fout(fname, std::ios_base::out | std::ios_base::binary |
+			                          (mFileRecords[file] > 0 ? std::ios_base::app : std::ios_base::trunc));
+
+			fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SpillRecord));
+
+			if (!fout)
+				return std::make_pair(false, "Error while writing the " + std::to_string(ksize) +
+				                             "-mers predicted as AMPs to file: " + fname);
+
+			mRuns.push_back(Run {file, mFileRecords[file], records.size(), false});
+			mFileRecords[file] += records.size();
+
+			return std::make_pair(true, std::string());
+		}
+
+		// Merge the runs by sequence, calling "onWindow(occs)" with the occurrences (as AMP
+		// k-mers) of consecutive sequences, grouped by sequence: a window has at least
+		// "windowSize" occurrences (but the last one) and the occurrences of a sequence are never
+		// split between windows
+		template<typename F>
+		bool merge(size_t windowSize, F&& onWindow) const {
+			std::vector<const SpillRecord*> files(mFileNames.size(), nullptr);
+			bool allOK {true};
+
+			for (size_t f = 0; f < files.size() && allOK; ++f) {
+				if (mFileRecords[f] > 0)
+					allOK = map(f, files[f]);
+			}
+
+			std::vector<Cursor> cursors;
+
+			for (size_t r = 0; r < mRuns.size() && allOK; ++r) {
+				const auto& run = mRuns[r];
+				auto first = run.inMemory ? mMemRuns[run.first].data() : files[run.file] + run.first;
+
+				cursors.push_back(Cursor {first, first + run.count, mLowerKSize + static_cast<uint>(run.file)});
+			}
+
+			// Cursors by the sequence of their next record
+			using Head = std::pair<uint32_t, size_t>;
+			std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+
+			for (size_t c = 0; c < cursors.size(); ++c)
+				heads.emplace(cursors[c].next->seqIdx, c);
+
+			std::vector<KmerOffset> window;
+
+			while (!heads.empty() && allOK) {
+				auto seqIdx = heads.top().first;
+
+				// All the occurrences of the sequence (in every run)
+				while (!heads.empty() && heads.top().first == seqIdx) {
+					auto c = heads.top().second;
+					auto& cursor = cursors[c];
+					heads.pop();
+
+					for (; cursor.next != cursor.end && cursor.next->seqIdx == seqIdx; ++cursor.next)
+						window.emplace_back(seqIdx, cursor.next->offset, cursor.ksize, true);
+
+					if (cursor.next != cursor.end)
+						heads.emplace(cursor.next->seqIdx, c);
+				}
+
+				if (window.size() >= windowSize) {
+					onWindow(window);
+					window.clear();
+				}
+			}
+
+			if (!window.empty() && allOK)
+				onWindow(window);
+
+			for (size_t f = 0; f < files.size(); ++f) {
+				if (files[f] != nullptr)
+					munmap(const_cast<SpillRecord*>(files[f]), mFileRecords[f] * sizeof(SpillRecord));
+			}
+
+			return allOK;
+		}
+
+		// Remove the spill files (and the runs kept in memory)
+		void remove() {
+			std::for_each(mFileNames.cbegin(), mFileNames.cend(), [] (const auto& fname) {
+				std::remove(fname.c_str());
+			});
+
+			mFileNames.clear();
+			mFileRecords.clear();
+			mRuns.clear();
+			mMemRuns.clear();
+			mMemBytes = 0;
+		}
+
+		const std::string& getFileName(uint ksize) const {
+			return mFileNames[ksize - mLowerKSize];
+		}
+
+	private:
+		// Records [first, first + count) of the file "file" or the run "first" kept in memory
+		struct Run {
+			size_t file;
+			size_t first;
+			size_t count;
+			bool inMemory;
+		};
+
+		// Next record of a run (of k-mers of size "ksize")
+		struct Cursor {
+			const SpillRecord* next;
+			const SpillRecord* end;
+			uint ksize;
+		};
+
+		// Map the whole file "file" (read sequentially, once)
+		bool map(size_t file, const SpillRecord*& records) const {
+			auto fd = ::open(mFileNames[file].c_str(), O_RDONLY);
+
+			if (fd < 0)
+				return false;
+
+			auto bytes = mFileRecords[file] * sizeof(SpillRecord);
+			auto addr = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (addr == MAP_FAILED)
+				return false;
+
+			madvise(addr, bytes, MADV_SEQUENTIAL);
+			records = static_cast<const SpillRecord*>(addr);
+
+			return true;
+		}
+
+		uint mLowerKSize {0};
+		size_t mMemBudget {std::numeric_limits<size_t>::max()};
+		size_t mMemBytes {0};                   // Bytes of the runs kept in memory
+		std::vector<std::string> mFileNames;    // One per k-mer size
+		std::vector<size_t> mFileRecords;       // Records written to every file
+		std::vector<Run> mRuns;
+		std::vector<std::vector<SpillRecord>> mMemRuns;
+
+	};
+
+}
+
+#endif //INPROT_KMER_SPILLS_H
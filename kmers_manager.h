@@ -9,14 +9,26 @@
 #include <unordered_map>
 #include <memory>
 #include "fasta_utils.h"
+#include "suffix_index.h"
+#include "thread_buffers.h"
+#include "seq_chunks.h"
+#include "seen_kmers.h"
+#include "kmer_partitions.h"
+#include "kmer_scanner.h"
+#include "coverage_bitmap.h"
+#include "kmer_spills.h"
+#include "memory_plan.h"
 #include "fasta_seq.h"
 #include "svm_scaling.h"
 #include "group_koff.h"
+#include "mds_writer.h"
+#include "fasta_writer.h"
 #include "rang.hpp"
 #include <tbb/tbb.h>
 #include <tbb/concurrent_unordered_map.h>
 #include <mutex>
 #include <random>
+#include <unistd.h>
 
 
 template <typename Condition>
@@ -25,23 +37,23 @@ using namespace rang;
 
 namespace fasta {
 
-
-	bool operator==(const FastaSeq& rhs, const FastaSeq& lhs) {
-        return &rhs == &lhs;
-	}
-
 	class KmersManager {
 
 	public:
 		KmersManager(const std::string& inFileName, const std::string& outFileName,
-		             uint lowerKSize, uint upperKSize, uint writePreds, bool awareMode, bool verbose):
+		             uint lowerKSize, uint upperKSize, uint writePreds, bool awareMode, bool seqMajor,
+		             bool fusedMode, size_t memoryLimit, uint minOccurrences, bool verbose):
 				mInFileName(inFileName), mOutFileName(outFileName), mLowerKSize(lowerKSize), mUpperKSize(upperKSize),
-				mWritePreds(writePreds), mTmpFiles(mUpperKSize - mLowerKSize + 1),
-				mKmersMap(mUpperKSize - mLowerKSize + 1), mAwareMode(awareMode), mVerbose(verbose) { }
+				mWritePreds(writePreds),
+				mKmersMap(mUpperKSize - mLowerKSize + 1), mAwareMode(awareMode), mSeqMajor(seqMajor),
+				mFusedMode(fusedMode), mMemoryLimit(memoryLimit), mMinOccurrences(minOccurrences), mVerbose(verbose) { }
 
 
 		template<typename T, typename M, EnableIf<std::is_floating_point<T>>...>
-		std::pair<bool, std::string> extract(SvmScaling<T>& scaling, M& model) noexcept {
+		std::pair<bool, std::string> extract(SvmScaling<T>& scaling, M& model,
+		                                     const md::DescriptorSet<T>* mdset = nullptr,
+		                                     KmerCache<T>* cache = nullptr,
+		                                     MdsWriter<T>* exporter = nullptr) noexcept {
 
 
 			if (mFseqs.empty())
@@ -52,528 +64,785 @@ namespace fasta {
                           << "A total of " << mFseqs.size() << " sequences" << style::reset << std::endl;
             }
 
-			// Memory mode: AWARE
-			// Low memory consumption
-			if (mAwareMode) { // ---------- Aware mode ----------
+			// The occurrences of the k-mers are kept while deduplicating them, so the AMPs do not
+			// have to be searched in the sequences when shrinking the proteome (but in aware mode,
+			// which trades that search for memory)
+			mKeepOccurrences = !mSeqMajor && !mAwareMode;
+
+			// Memory budget: the phases that do not fit are moved to disk (the k-mers are partitioned
+			// and/or the occurrences of the AMPs are spilled to a temp file per k-mer size). The aware
+			// mode spills all the occurrences of the AMPs and extracts a single k-mer size at a time
+			mPlan = MemoryPlan::make(mFseqs, mLowerKSize, mUpperKSize, mMemoryLimit, mAwareMode, mKeepOccurrences);
+			mSpills.open(mLowerKSize, mUpperKSize, generateTmpBaseName(), mPlan.ampBudget);
+
+			// The occurrences of a bucket are bounded by its size, so a partitioned extraction keeps
+			// them even in aware mode (instead of scanning the proteome for every bucket and size)
+			if (mPlan.partitioned && !mSeqMajor)
+				mKeepOccurrences = true;
+
+			if (mVerbose && (mMemoryLimit > 0 || mAwareMode)) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << "Memory plan: " << (mPlan.partitioned ? "partitioned" : "in-memory") << " extraction, "
+				          << (mPlan.ampBudget == MemoryPlan::UNLIMITED ? std::string("unlimited") :
+				              std::to_string((mPlan.ampBudget + 1023) / 1024) + " KB")
+				          << " for the occurrences of the AMPs" << style::reset << std::endl;
+			}
 
-				auto basename = generateTmpBaseName();
-                std::string error;
-                bool allOK = true;
+			// In fused mode, the occurrences of the AMPs are marked as soon as they are predicted
+			if (mFusedMode)
+				mCoverage.reset(mFseqs);
 
-				for (auto i = mLowerKSize; i <= mUpperKSize; ++i)
-                    mTmpFiles[i] = std::to_string(i) + "_" + basename;
+			if (mSeqMajor)
+				return extractBySequence(scaling, model, mdset, cache);
 
+			if (mPlan.partitioned)
+				return extractByPartitions(scaling, model, mdset, cache, exporter);
 
-				// For each k-mer size (one by one):
-				// 1.- Extract the unique k-mers
-				// 2.- Evaluate the k-mers (predict against the SVM)
-				// 3.- Add if the k-mer is predicted as AMP
-				for (auto i = mLowerKSize; i <= mUpperKSize; ++i) {
+			// For a range of k-mer sizes, the suffix array of the sequences is built once and the
+			// unique k-mers of every size are derived from it
+			std::unique_ptr<SuffixIndex> index;
 
-					if (mVerbose) {
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset
-						          << fg::blue << "Extracting unique " << i << "-mers" << std::endl;
-					}
+			if (mUpperKSize > mLowerKSize && SuffixIndex::fits(mFseqs)) {
+				if (mVerbose) {
+					std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+					          << "Building the suffix array of the sequences" << style::reset << std::endl;
+				}
 
-					// Extract the uniques k-mers of size "i"
-					auto kmers = FastaUtils::uniqKmers(mFseqs, i);
+				index = std::make_unique<SuffixIndex>(mFseqs, mUpperKSize);
+			}
 
-					if (mVerbose) {
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          << "A total of " << kmers.size() << " unique " << i
-						          << "-mers" << std::endl;
+			// The k-mer sizes go through a pipeline, so the extraction of a size overlaps with the
+			// evaluation of the previous ones and with the writing of the ones before them:
+			// 1.- Extract the unique k-mers
+			// 2.- Evaluate the k-mers (predict against the SVM) and sort them by AMP activity
+			// 3.- Write the predicteds and keep the k-mers predicted as AMP
+			auto nextKSize = mLowerKSize;
+			bool allOK {true};
+			std::string error;
 
+			tbb::parallel_pipeline(mPlan.maxBatches,
+				tbb::make_filter<void, std::shared_ptr<KmersBatch>>(tbb::filter::serial_in_order,
+					[&] (tbb::flow_control& fc) -> std::shared_ptr<KmersBatch> {
 
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          << "Evaluating " << kmers.size() << " unique " << i << "-mers" << std::endl;
-					}
+						if (nextKSize > mUpperKSize || !allOK) {
+							fc.stop();
+							return nullptr;
+						}
 
-					// Evaluate k-mers and add to "mKmersMap" those k-mers predicted as AMP
-					tbb::parallel_for_each(kmers.begin(), kmers.end(), [&](auto &koff) {
-						koff.evaluate(scaling, model);
-					});
+						auto batch = std::make_shared<KmersBatch>();
+						batch->ksize = nextKSize++;
 
-					// Sort the k-mers by AMP activity
-					// The non-AMPs will be at the end
-                    tbb::parallel_sort(kmers.begin(), kmers.end(), [] (const auto& ki, const auto& kj) {
-						return ki.isAMP() && !kj.isAMP();
-					});
+						if (mVerbose) {
+							std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+							          << "Extracting unique " << batch->ksize << "-mers" << std::endl;
+						}
 
-					// Write predicteds (AMPs, NAMPs, boths) k-mers in multifasta format
-					if (mWritePreds != Globals::WRITE_NONE_PREDS)
-						auto okErr = writePreds(kmers);
+						// Extract the uniques k-mers of size "ksize" (and their occurrences, in normal mode)
+						auto occurrences = mKeepOccurrences ? &batch->occurrences : nullptr;
+						batch->kmers = index ? index->uniqKmers(batch->ksize, occurrences)
+						                     : FastaUtils::uniqKmers(mFseqs, batch->ksize, occurrences);
 
-					// As the k-mers are sorted by first the AMPs and later the Non-AMPs, then, if we find
-					// the first non-AMP, we know that at that point, all the k-mers on the left are AMPs
-					auto lastNonAMP = std::find_if(kmers.cbegin(), kmers.cend(), [](const auto &k) {
-						return k.isAMP() == false;
-					});
+						if (mVerbose) {
+							std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+							          << "A total of " << batch->kmers.size() << " unique " << batch->ksize
+							          << "-mers" << std::endl;
+						}
 
-					// Calculate the total de AMPs
-					size_t totalAMPs {0};
-					if (lastNonAMP == kmers.cend())
-						totalAMPs = kmers.size();
-					else
-						totalAMPs = static_cast<size_t>(std::distance(kmers.cbegin(), lastNonAMP));
+						dropRareKmers(*batch);
+						return batch;
+					}) &
 
-					// Get the k-mer temp filename and write out
-					auto fname = mTmpFiles[i];
+				tbb::make_filter<std::shared_ptr<KmersBatch>, std::shared_ptr<KmersBatch>>(tbb::filter::parallel,
+					[&] (std::shared_ptr<KmersBatch> batch) {
 
-					if (mVerbose) {
+						auto& kmers = batch->kmers;
 
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          << "Writing " << totalAMPs << " " << i << "-mers predicted as AMPs (of "
-						          << kmers.size() << " uniques" << ") to file: " << fname << std::endl;
-					}
+						if (mVerbose) {
+							std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+							          << "Evaluating " << kmers.size() << " unique " << batch->ksize << "-mers"
+							          << std::endl;
+						}
 
-					std::ofstream fout(fname, std::ios_base::out | std::ios_base::trunc);
+						if (!evaluateKmers(kmers, batch->ksize, scaling, model, mdset, cache, exporter)) {
+							batch->error = "Error while exporting the molecular descriptors of " +
+							               std::to_string(batch->ksize) + "-mers";
+							return batch;
+						}
 
-					// Check if creating the file was done with success
-					// TODO Return if error occurred and information about the error if no exception is thrown
-					if (!fout) {
-						allOK = false;
-                        error = "Failed to open file: " + fname;
-                        break;
-					}
+						sortByActivity(*batch);
+						return batch;
+					}) &
 
-					// Insert k-mers information as:
-					// Fasta sequence index (starting from zero) [space]
-					// K-mer offset (start position) [space]
-					// k-mer size [end line]
-                    for (size_t j {0}; j < totalAMPs; ++j) {
+				tbb::make_filter<std::shared_ptr<KmersBatch>, void>(tbb::filter::serial_in_order,
+					[&] (std::shared_ptr<KmersBatch> batch) {
 
-						const auto& koff = kmers[j];
-                        const auto fsItr = std::find_if(mFseqs.cbegin(), mFseqs.cend(), [&](const auto &fs) {
-                            return fs == koff.getFastaSeq();
-                        });
+						if (!allOK)
+							return;
 
-                        // Get the fasta sequence index from the vector of fasta sequences
-                        auto fsIdx = std::distance(mFseqs.cbegin(), fsItr);
+						if (!batch->error.empty()) {
+							allOK = false;
+							error = batch->error;
+							return;
+						}
 
-                        // Write out the fasta sequence index, k-mers offset and k-mer size
-                        fout << fsIdx << " "
-                             << koff.getOffset() << " "
-                             << koff.getSize() << "\n";
+						auto okErr = storeKmers(*batch);
 
+						if (!okErr.first) {
+							allOK = false;
+							error = okErr.second;
+						}
+					})
+			);
 
-                        if (fout.fail() || fout.bad()) {
-                            allOK = false;
-                            error = "Error while writing k-mer (offset=" + std::to_string(koff.getOffset())  + ";" +
-                                    "size=" + std::to_string(koff.getSize()) + ") for fasta sequence " +
-                                    mFseqs[fsIdx].getDesc() + " (index=" + std::to_string(fsIdx)
-                                    + ") in file: " + fname;
-                            break;
-                        }
+			return std::make_pair(allOK, error); // ok, errors
 
-                    }
+		} // End of extract(...)
 
-                    if (!allOK)
-                        break;
+		// Export the molecular descriptors of the input's sequences (a list of peptides), where
+		// each sequence is taken as a whole k-mer
+		template<typename T, EnableIf<std::is_floating_point<T>>...>
+		std::pair<bool, std::string> exportPeptides(MdsWriter<T>& exporter,
+		                                            const md::DescriptorSet<T>* mdset = nullptr) {
 
-					fout.flush();
+			if (mFseqs.empty())
+				mFseqs = FastaUtils::readFasta(mInFileName);
 
-				} // End of for (lower..upper)
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << "Exporting the molecular descriptors of " << mFseqs.size() << " peptides"
+				          << style::reset << std::endl;
+			}
 
-                return std::make_pair(allOK, error);
+			// Offsets of each peptide (one per line) into the k-mers file
+			std::vector<size_t> kmersOffsets(mFseqs.size() + 1, 0);
+			for (size_t i = 0; i < mFseqs.size(); ++i)
+				kmersOffsets[i + 1] = kmersOffsets[i] + mFseqs[i].length() + 1;
 
-			} else { // ---------- Normal mode ----------
+			auto block = exporter.reserve(mFseqs.size(), kmersOffsets.back());
+			std::atomic<bool> allOK {true};
 
-				// For each k-mer size (one by one):
-				// 1.- Extract the unique k-mers
-				// 2.- Evaluate the k-mers (predict against the SVM)
-				// 3.- Add if the k-mer is predicted as AMP
-				for (auto i = mLowerKSize; i <= mUpperKSize; ++i) {
+			// The peptides could be longer than any k-mer, so they are not taken as "KmerOffset"
+			const md::DescriptorSet<T> defaultSet;
+			const auto& descSet = (mdset != nullptr) ? *mdset : defaultSet;
 
-					if (mVerbose) {
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue <<
-						          "Extracting unique " << i << "-mers" << std::endl;
-					}
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, mFseqs.size(), 1'024), [&] (const auto& r) {
 
-					// Extract the uniques k-mers of size "i"
-					auto kmers = FastaUtils::uniqKmers(mFseqs, i);
+				std::vector<T> rows(r.size() * exporter.getNumCols());
+				std::string kmersBuff;
+				kmersBuff.reserve(kmersOffsets[r.end()] - kmersOffsets[r.begin()]);
 
-					if (mVerbose) {
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					const auto& fs = mFseqs[i];
+					descSet.calculate(fs.data(), fs.length(), &rows[(i - r.begin()) * exporter.getNumCols()]);
+					kmersBuff.append(fs.data(), fs.length());
+					kmersBuff += '\n';
+				}
 
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          << "A total of " << kmers.size() << " unique " << i << "-mers" << std::endl;
+				if (!exporter.writeRows(block.firstRow + r.begin(), rows.data(), r.size()) ||
+						!exporter.writeKmers(block.firstByte + kmersOffsets[r.begin()], kmersBuff.data(),
+						                     kmersBuff.size())) {
+					allOK = false;
+				}
+			});
 
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          << "Evaluating " << kmers.size() << " unique " << i << "-mers" << std::endl;
-					}
+			if (!allOK)
+				return std::make_pair(false, "Error while exporting the molecular descriptors");
 
-					// Evaluate k-mers and add to "mKmersMap" those k-mers predicted as AMP
-					tbb::parallel_for_each(kmers.begin(), kmers.end(), [&] (auto& koff) {
-						koff.evaluate(scaling, model);
-					});
+			return std::make_pair(true, std::string());
+		}
 
-					tbb::parallel_sort(kmers.begin(), kmers.end(), [] (const auto& ki, const auto& kj) {
-						return ki.isAMP() && !kj.isAMP();
-					});
+		bool shrinkProteome() {
+			if (mFseqs.empty())
+				return false;
 
-					auto lastNAMP = std::find_if(kmers.cbegin(), kmers.cend(), [] (const auto& koff) {
-						return koff.isAMP() == false;
-					});
+			FastaWriter outFile(mFseqs);
 
-					// Write predicteds (AMPs, NAMPs, boths) k-mers in multifasta format
-					if (mWritePreds != Globals::WRITE_NONE_PREDS)
-						auto okErr = writePreds(kmers);
+			if (!outFile.open(mOutFileName))
+				return false;
 
-					// Calculate the total de AMPs
-					size_t totalAMPs {0};
-					if (lastNAMP == kmers.cend())
-						totalAMPs = kmers.size();
-					else
-						totalAMPs = static_cast<size_t>(std::distance(kmers.cbegin(), lastNAMP));
+			// For each sequence (in parallel), group its overlapped AMP k-mers: every thread keeps
+			// its own groups, which are gathered at the end
+			tbb::enumerable_thread_specific<std::vector<GroupKoff>> localGroups;
+			tbb::enumerable_thread_specific<CoverageBitmap> localCoverages;
+			std::mutex progressMutex;
 
+			auto progress = [&] (size_t shrinked) {
+				if (mVerbose) {
+					std::lock_guard<std::mutex> lock(progressMutex);
+					std::cout << style::bold << fg::blue << "[" << shrinked << " / " << mFseqs.size()
+					          << "] " << style::reset << fg::blue << "sequences shrinked\r";
+				}
+			};
 
-                    // Reserve space for all AMPs and insert them
-                    auto& kmersSize = mKmersMap[i];
-                    kmersSize.reserve(totalAMPs);
+			// Sequences of the occurrences "occs" (grouped by sequence)
+			auto shrinkOccurrences = [&] (const std::vector<KmerOffset>& occs) {
+				std::vector<size_t> begins;
 
-                    tbb::parallel_for_each(kmers.begin(), kmers.end(), [&] (auto& koff) {
-                        if (koff.isAMP())
-                            kmersSize.emplace_back(koff);
-                    });
+				for (size_t i = 0; i < occs.size(); ++i) {
+					if (i == 0 || occs[i].getSeqIdx() != occs[i - 1].getSeqIdx())
+						begins.push_back(i);
+				}
 
+				begins.push_back(occs.size());
 
-					// Shrink the vector for reduce memory usage
-                    kmersSize.shrink_to_fit();
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, begins.size() - 1), [&] (const auto& r) {
+					auto& groups = localGroups.local();
+					auto& coverage = localCoverages.local();
 
-					if (mVerbose) {
+					for (auto s = r.begin(); s != r.end(); ++s)
+						reduceKoffs(occs.data() + begins[s], occs.data() + begins[s + 1], coverage, groups);
 
-						std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-						          <<  mKmersMap[i].size() << " " << i << "-mers predicted as AMPs (of "
-						          << kmers.size() << " uniques)" << std::endl;
-					}
+					progress(occs[begins[r.end()] - 1].getSeqIdx() + 1);
+				});
+			};
 
-				} // End of for (lower..upper)
+			if (mFusedMode) {
+				// The occurrences of the AMPs are already marked
+				std::atomic<size_t> numSeq {0};
 
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, mFseqs.size()), [&] (const auto& r) {
+					auto& groups = localGroups.local();
+					auto& coverage = localCoverages.local();
 
-			} // End of else {
+					for (auto fsIdx = r.begin(); fsIdx != r.end(); ++fsIdx) {
+						if (mCoverage.load(fsIdx, coverage))
+							reduceCoverage(fsIdx, coverage, groups);
+					}
 
+					progress(numSeq += r.size());
+				});
+			} else if (keepsKmers()) {
+				// The occurrences of the AMPs are found by scanning the sequences for all the AMPs
+				// at once
+				scanAmpOccurrences();
+				groupAmpOccurrences();
+				shrinkOccurrences(mAmpOccs);
+				std::vector<KmerOffset>().swap(mAmpOccs);
+			} else {
+				// The occurrences of the AMPs are merged from their runs (in memory or read
+				// sequentially from the spills, in order of sequence) and the sequences are shrinked
+				// as their occurrences come in
+				if (!mSpills.merge(mPlan.windowSize, shrinkOccurrences))
+					return false;
+			}
 
-			return std::make_pair(true, std::string()); // ok, errors
+			auto groups = ThreadBuffers::concat(localGroups);
 
-		} // End of extract(...)
+			if (mVerbose) {
+				std::cout << std::endl << style::bold << fg::blue << "[INFO] " << style::reset
+				          << fg::blue << "Writing shrinked sequences" << style::reset << std::endl;
+			}
 
-		bool shrinkProteome() {
-			if (mKmersMap.empty() && !mAwareMode)
+			// Get the last unique group
+			auto totUniqGroups = reduceGroups(groups);
+
+			// Write out those overlapped (grouped) k-mers
+			if (!writeGroups(outFile, groups, totUniqGroups) || !outFile.close())
 				return false;
 
-			std::ofstream outFile(mOutFileName, std::ios_base::trunc | std::ios_base::out);
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << "Written a total of " << totUniqGroups << " new sequences "
+				          << "to file: " << mOutFileName << std::endl;
+			}
 
-			// If memory save is enabled, then, for each sequence,
-			// reduce and write the reduced sequence
-			if (mAwareMode) {
+			std::cout << std::endl;
 
-				if (mVerbose) {
+			if (mVerbose) {
+				std::cout << style::bold << fg::green << "[STATUS] " << style::reset << fg::green
+				          << "Removing temporary files..." << std::endl;
+			}
 
-					size_t numSeq{0};
-                    tbb::concurrent_vector<GroupKoff> groups;
+			// Removing temporary files
+			mSpills.remove();
 
-					std::for_each(mFseqs.cbegin(), mFseqs.cend(), [&](const auto &fs) {
+			return true; // all OK
+		}
 
-						tbb::concurrent_vector<std::shared_ptr<KmerOffset>> koffs_fs;
 
-						tbb::parallel_for_each(mTmpFiles.begin(), mTmpFiles.end(), [&](auto &pair) {
-							koffFromFsFile(fs, koffs_fs, pair.second);
-						});
+	private:
+		// K-mers of one size going through the extraction pipeline
+		struct KmersBatch {
+			uint ksize {0};
+			std::vector<KmerOffset> kmers;
+			size_t totalAMPs {0};   // The AMPs are the first "totalAMPs" k-mers
+			bool append {false};    // Add to the k-mers of the same size already stored (or written)
+			KmerOccurrences occurrences;    // Occurrences of the k-mers (normal mode)
+			std::string error;
+		};
 
-						reduceKoffs(fs, koffs_fs, groups);
-						groups.shrink_to_fit();
+		// Sequence-major extraction: every sequence is visited once and, for each start offset, the
+		// k-mers of all the sizes [lower, upper] are fingerprinted (extending the previous one by a
+		// residue) and the ones not seen before are evaluated, while the residues are still in cache.
+		// The k-mers of every size are then sorted and stored as in the k-major extraction.
+		template<typename T, typename M, EnableIf<std::is_floating_point<T>>...>
+		std::pair<bool, std::string> extractBySequence(SvmScaling<T>& scaling, M& model,
+		                                               const md::DescriptorSet<T>* mdset,
+		                                               KmerCache<T>* cache) {
+
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << "Extracting and evaluating the unique " << mLowerKSize << "-mers to " << mUpperKSize
+				          << "-mers by sequence" << style::reset << std::endl;
+			}
+
+			SeenKmers seen(mFseqs);
+			auto chunks = SeqChunks::split(mFseqs, mLowerKSize);
+
+			// With an occurrences threshold, the k-mers can only be evaluated once they are all seen
+			auto evalOnVisit = mMinOccurrences <= 1;
+
+			tbb::parallel_for(size_t {0}, chunks.size(), [&] (size_t c) {
+				const auto& chunk = chunks[c];
 
-                        std::cout << style::bold << fg::blue << "[" << ++numSeq << " / " << mFseqs.size()
-                                  << "] " << style::reset << fg::blue << "sequences shrinked\r";
+				for (auto i = chunk.firstSeq; i < chunk.lastSeq; ++i) {
+					const auto& seq = mFseqs[i];
+					auto starts = chunk.starts(seq.length(), mLowerKSize);
+					auto data = seq.data();
 
-					}); // End of for_each (mFseqs...)
+					for (auto offset = starts.first; offset < starts.second; ++offset) {
+						auto maxSize = std::min<size_t>(mUpperKSize, seq.length() - offset);
+						KmerFingerprint fp;
 
-                    std::cout << std::endl << style::bold << fg::blue << "[INFO] " << style::reset
-                              << fg::blue << "Writing shrinked sequences" << style::reset << std::endl;
+						for (size_t k = 0; k < mLowerKSize - 1; ++k)
+							fp.extend(data[offset + k]);
+
+						for (auto k = mLowerKSize; k <= maxSize; ++k) {
+							fp.extend(data[offset + k - 1]);
+
+							seen.visit(fp, i, offset, [&] (KmerOffset& koff) {
+								if (evalOnVisit)
+									koff.evaluate(mFseqs, scaling, model, mdset, cache);
+							});
+						}
+					}
+				}
+			});
 
-                    // Get the last unique group
-                    auto totUniqGroups = reduceGroups(groups);
+			auto kmersBySize = seen.kmers(mLowerKSize, mUpperKSize);
 
-                    // Write out those overlapped (grouped) k-mers
-                    writeGroups(outFile, groups, totUniqGroups);
+			for (auto ksize = mLowerKSize; ksize <= mUpperKSize; ++ksize) {
+				KmersBatch batch;
+				batch.ksize = ksize;
+				batch.kmers = std::move(kmersBySize[ksize - mLowerKSize]);
 
+				if (mVerbose) {
 					std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
-					          << "Written a total of " << totUniqGroups << " new sequences "
-					          << "to file: " << mOutFileName << std::endl;
+					          << "A total of " << batch.kmers.size() << " unique " << ksize << "-mers"
+					          << std::endl;
+				}
 
-				} else {
+				if (!evalOnVisit) {
+					dropRareKmers(batch);
+					evaluateKmers(batch.kmers, ksize, scaling, model, mdset, cache,
+					              static_cast<MdsWriter<T>*>(nullptr));
+				}
 
-                    tbb::concurrent_vector<GroupKoff> groups;
+				sortByActivity(batch);
+				auto okErr = storeKmers(batch);
 
-					std::for_each(mFseqs.cbegin(), mFseqs.cend(), [&](const auto &fs) {
+				if (!okErr.first)
+					return okErr;
+			}
 
-						tbb::concurrent_vector<std::shared_ptr<KmerOffset>> koffs_fs;
+			return std::make_pair(true, std::string());
+		}
 
-						tbb::parallel_for_each(mTmpFiles.begin(), mTmpFiles.end(), [&](auto &pair) {
-							koffFromFsFile(fs, koffs_fs, pair.second);
-						});
+		// Partitioned (external-memory) extraction: the k-mers are routed by minimizer to on-disk
+		// buckets and then, one bucket at a time, the unique k-mers of every size are extracted,
+		// evaluated and stored, so only a bucket's k-mers are in memory (within "mMemoryLimit")
+		template<typename T, typename M, EnableIf<std::is_floating_point<T>>...>
+		std::pair<bool, std::string> extractByPartitions(SvmScaling<T>& scaling, M& model,
+		                                                 const md::DescriptorSet<T>* mdset,
+		                                                 KmerCache<T>* cache, MdsWriter<T>* exporter) {
 
-						koffs_fs.shrink_to_fit();
-						reduceKoffs(fs, koffs_fs, groups);
-						groups.shrink_to_fit();
+			auto numBuckets = mPlan.numBuckets;
+			KmerPartitions partitions(mFseqs, mLowerKSize, numBuckets, generateTmpBaseName());
 
-					}); // End of for_each (mFseqs...)
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << "Partitioning the k-mers into " << numBuckets << " buckets" << style::reset
+				          << std::endl;
+			}
 
-                    // Get the last unique group
-                    auto totUniqGroups = reduceGroups(groups);
+			auto okErr = partitions.partition();
 
-                    // Write out those overlapped (grouped) k-mers
-                    writeGroups(outFile, groups, totUniqGroups);
+			if (!okErr.first)
+				return okErr;
 
-				}
+			// Sizes with k-mers already stored (the following buckets are appended to them)
+			std::vector<bool> stored(mUpperKSize - mLowerKSize + 1, false);
 
-				std::cout << std::endl;
+			for (size_t b = 0; b < partitions.size(); ++b) {
+				std::vector<SuperKmer> skmers;
+				okErr = partitions.load(b, skmers);
+
+				if (!okErr.first)
+					return okErr;
 
 				if (mVerbose) {
-					std::cout << style::bold << fg::green << "[STATUS] " << style::reset << fg::green
-					          << "Removing temporary files..." << std::endl;
+					std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+					          << "Extracting the k-mers of bucket " << (b + 1) << " / " << partitions.size()
+					          << " (" << skmers.size() << " super-k-mers)" << style::reset << std::endl;
 				}
 
-				// Removing temporary files
-				std::for_each(mTmpFiles.cbegin(), mTmpFiles.cend(), [] (const auto& pair) {
-					std::remove(pair.second.c_str());
-				});
+				for (auto ksize = mLowerKSize; ksize <= mUpperKSize; ++ksize) {
+					KmersBatch batch;
+					batch.ksize = ksize;
+					batch.kmers = partitions.uniqKmers(skmers, ksize, mKeepOccurrences ? &batch.occurrences : nullptr);
+					batch.append = stored[ksize - mLowerKSize];
 
+					dropRareKmers(batch);
 
-			} else { // ---------- Normal mode ----------
+					if (batch.kmers.empty())
+						continue;
 
-				// For each sequence:
-				// 1.- Extract the k-mers from that sequence.
-				// 2.- Group those overlapped k-mers.
-				// 3.- Write out those overlapped k-mers.
-				//
-				// Perform the three steps above for each sequence, one at a time
-				if (mVerbose) {
+					if (!evaluateKmers(batch.kmers, ksize, scaling, model, mdset, cache, exporter)) {
+						return std::make_pair(false, "Error while exporting the molecular descriptors of " +
+						                             std::to_string(ksize) + "-mers");
+					}
 
-					size_t numSeq {0};
-                    tbb::concurrent_vector<GroupKoff> groups;
+					sortByActivity(batch);
+					okErr = storeKmers(batch);
 
-					std::for_each(mFseqs.begin(), mFseqs.end(), [&] (const auto& fs) {
+					if (!okErr.first)
+						return okErr;
 
-						auto koffs = koffFromSeq(fs);
-                        reduceKoffs(fs, koffs, groups);
+					stored[ksize - mLowerKSize] = true;
+				}
+			}
 
-                        std::cout << style::bold << fg::blue << "[" << ++numSeq << " / " << mFseqs.size()
-                                  << "] " << style::reset << fg::blue << "sequences shrinked\r";
+			return std::make_pair(true, std::string());
+		}
 
-					});
+		// Remove (before evaluating them) the k-mers of the batch with less than "mMinOccurrences"
+		// occurrences
+		void dropRareKmers(KmersBatch& batch) const {
+			if (mMinOccurrences <= 1)
+				return;
 
-                    std::cout << std::endl << style::bold << fg::blue << "[INFO] " << style::reset
-                              << fg::blue << "Writing shrinked sequences" << style::reset << std::endl;
+			auto& kmers = batch.kmers;
+			auto total = kmers.size();
 
-                    // Get the last unique group
-                    auto totUniqGroups = reduceGroups(groups);
+			kmers.erase(std::remove_if(kmers.begin(), kmers.end(), [this] (const auto& koff) {
+				return koff.getCount() < mMinOccurrences;
+			}), kmers.end());
 
-                    // Write out those overlapped (grouped) k-mers
-                    writeGroups(outFile, groups, totUniqGroups);
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << kmers.size() << " of " << total << " unique " << batch.ksize << "-mers occur at least "
+				          << mMinOccurrences << " times" << std::endl;
+			}
+		}
 
-					std::cout << style::bold << fg::blue << "[INFO] " << style::reset
-					          << fg::blue << "Written a total of " << totUniqGroups << " new sequences "
-					          << "to file: " << mOutFileName << std::endl;
+		// Sort the k-mers of the batch by AMP activity (the non-AMPs will be at the end)
+		void sortByActivity(KmersBatch& batch) const {
+			auto& kmers = batch.kmers;
 
-				} else {
+			tbb::parallel_sort(kmers.begin(), kmers.end(), [] (const auto& ki, const auto& kj) {
+				return ki.isAMP() && !kj.isAMP();
+			});
 
-                    tbb::concurrent_vector<GroupKoff> groups;
+			auto lastNAMP = std::find_if(kmers.cbegin(), kmers.cend(), [] (const auto& koff) {
+				return koff.isAMP() == false;
+			});
 
-					std::for_each(mFseqs.begin(), mFseqs.end(), [&] (const auto& fs) {
+			batch.totalAMPs = static_cast<size_t>(std::distance(kmers.cbegin(), lastNAMP));
+		}
 
-						auto koffs = koffFromSeq(fs);
-						reduceKoffs(fs, koffs, groups);
+		// Write the predicteds (if asked) and keep the AMPs of the batch (in memory or in a temp
+		// file, depending on the memory mode)
+		std::pair<bool, std::string> storeKmers(KmersBatch& batch) {
 
-					});
+			// Write predicteds (AMPs, NAMPs, boths) k-mers in multifasta format
+			if (mWritePreds != Globals::WRITE_NONE_PREDS) {
+				auto okErr = writePreds(batch.kmers, batch.append);
 
-                    // Get the last unique group
-                    auto totUniqGroups = reduceGroups(groups);
+				if (!okErr.first)
+					return okErr;
+			}
 
-                    // Write out those overlapped (grouped) k-mers
-                    writeGroups(outFile, groups, totUniqGroups);
+			if (mFusedMode)
+				return coverKmers(batch);
+
+			return keepsKmers() ? keepKmers(batch) : spillKmers(batch);
+		}
 
+		// The AMPs themselves are kept (in "mKmersMap") only in sequence-major mode, where their
+		// occurrences are not known until the sequences are scanned for them
+		bool keepsKmers() const {
+			return mSeqMajor && !mAwareMode;
+		}
+
+		// Keep all the occurrences of the k-mers predicted as AMP of the batch (kept while
+		// deduplicating them or, in sequence-major mode, found by scanning the sequences) as a run
+		// of "mSpills": in memory, within the budget, or in the temp file of their size
+		std::pair<bool, std::string> spillKmers(KmersBatch& batch) {
+			const auto& kmers = batch.kmers;
+			std::vector<SpillRecord> records;
+
+			if (mKeepOccurrences) {
+				std::vector<size_t> offsets(batch.totalAMPs + 1, 0);
+
+				for (size_t i = 0; i < batch.totalAMPs; ++i) {
+					auto occs = batch.occurrences.of(kmers[i]);
+					offsets[i + 1] = offsets[i] + static_cast<size_t>(occs.second - occs.first);
 				}
 
-				std::cout << std::endl;
+				records.resize(offsets.back());
+
+				tbb::parallel_for(size_t {0}, batch.totalAMPs, [&] (size_t i) {
+					auto occs = batch.occurrences.of(kmers[i]);
+					std::transform(occs.first, occs.second, records.begin() + offsets[i], [] (const auto& occ) {
+						return SpillRecord {occ.seqIdx, occ.offset};
+					});
+				});
+
+				batch.occurrences = KmerOccurrences();
+			} else {
+				std::vector<KmerOffset> amps(kmers.cbegin(), kmers.cbegin() + batch.totalAMPs);
 
+				for (const auto& koff : KmerScanner(mFseqs, amps).occurrences(mFseqs))
+					records.push_back(SpillRecord {static_cast<uint32_t>(koff.getSeqIdx()),
+					                               static_cast<uint32_t>(koff.getOffset())});
 			}
 
-			outFile.close();
-			return true; // all OK
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << batch.totalAMPs << " " << batch.ksize << "-mers predicted as AMPs (of " << kmers.size()
+				          << " uniques), " << records.size() << " occurrences "
+				          << (mSpills.fits(records.size()) ? std::string("kept in memory")
+				                                           : "written to file: " + mSpills.getFileName(batch.ksize))
+				          << std::endl;
+			}
+
+			return mSpills.write(batch.ksize, records);
 		}
 
+		// Keep (in "mKmersMap") the k-mers predicted as AMP of the batch (sequence-major mode)
+		std::pair<bool, std::string> keepKmers(KmersBatch& batch) {
+			const auto& kmers = batch.kmers;
 
-	private:
-		tbb::concurrent_vector<std::shared_ptr<KmerOffset>> koffFromSeq(const FastaSeq& fs) {
-
-			// Initialize the vector with reference to k-mers for each sequences (fs)
-			tbb::concurrent_vector<std::shared_ptr<KmerOffset>> refKmers;
-			refKmers.reserve(1'000);
-
-			// For each k-mer, search if the given k-mer, k, was extracted from the sequence "fs"
-			// If so, then add to the "refKmers" vector for later add the vector to the
-			// "shrinked" unordered_map.
-			tbb::parallel_for_each(mKmersMap.begin(), mKmersMap.end(), [&] (const auto& pair) {
-
-				// Get the k-mers of size "pair.first"
-				const auto& kmers = pair.second;
-
-				// For earch k-mer, check if it is a reference to the given sequence, fs
-				tbb::parallel_for_each(kmers.cbegin(), kmers.cend(), [&] (const auto& koff) {
-
-					// Add those k-mers that were not extracted directly from the seq `fs` but they are present
-					// in the sequence (repeateds in other sequences).
-					//
-					// For example, the k-mers ki could be present in seq1 and seq2, but only one instance
-					// will be kept when the duplicates were removed when obtaining the uniques
-					// in order to avoid redundant calculation of the molecular descriptors and
-					// evaluation of the SVM
-					size_t pos {0};
-					const auto& kmer = koff.getKmer();
-
-					while ((pos = fs.getSeq().find(kmer, pos)) != std::string::npos) {
-						refKmers.emplace_back(std::make_shared<KmerOffset>(fs, pos, koff.getSize(), true));
-						++pos;
-					}
+			// The AMPs are the first k-mers of the batch
+			auto& kmersSize = mKmersMap[batch.ksize];
 
+			if (!batch.append)
+				kmersSize.clear();
 
-				});
+			kmersSize.insert(kmersSize.end(), kmers.cbegin(), kmers.cbegin() + batch.totalAMPs);
 
-			});
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << batch.totalAMPs << " " << batch.ksize << "-mers predicted as AMPs (of "
+				          << kmers.size() << " uniques)" << std::endl;
+			}
 
-			refKmers.shrink_to_fit();
-			return refKmers;
+			return std::make_pair(true, std::string());
 		}
 
-		void koffFromFsFile(const FastaSeq& fs,
-		                    tbb::concurrent_vector<std::shared_ptr<KmerOffset>>& refKmers,
-		                    const std::string& filename) {
+		// Mark (in "mCoverage") all the occurrences of the k-mers predicted as AMP of the batch and
+		// release them (fused mode)
+		std::pair<bool, std::string> coverKmers(KmersBatch& batch) {
+			const auto& kmers = batch.kmers;
 
+			tbb::parallel_for(size_t {0}, batch.totalAMPs, [&] (size_t i) {
+				auto occs = batch.occurrences.of(kmers[i]);
 
-			std::ifstream inFile(filename);
+				for (auto occ = occs.first; occ != occs.second; ++occ)
+					mCoverage.mark(occ->seqIdx, occ->offset, occ->offset + batch.ksize);
+			});
 
-			if (!inFile) {
-				std::cerr << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
-				          << "To run-out from koffFromFsFile for seq: " << fs.getDesc()
-				          << "\tand file: " << filename << style::reset << std::endl;
+			batch.occurrences = KmerOccurrences();
 
-				return;
+			if (mVerbose) {
+				std::cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				          << batch.totalAMPs << " " << batch.ksize << "-mers predicted as AMPs (of "
+				          << kmers.size() << " uniques)" << std::endl;
 			}
 
+			return std::make_pair(true, std::string());
+		}
 
-			unsigned long fsIdx {0};
-			size_t koff_offset {0};
-			uint koff_size {0};
+		// Group (counting sort) the occurrences of the AMPs by sequence
+		void groupAmpOccurrences() {
+			std::vector<size_t> begins(mFseqs.size() + 1, 0);
 
-			while (inFile >> fsIdx >> koff_offset >> koff_size) {
+			for (const auto& koff : mAmpOccs)
+				++begins[koff.getSeqIdx() + 1];
 
-				// Add those k-mers that were not extracted directly from the seq `fs` but they are present
-				// in the sequence (repeateds in other sequences).
-				//
-				// For example, the k-mers ki could be present in seq1 and seq2, but only one instance
-				// will be kept when the duplicates were removed when obtaining the uniques
-				// in order to avoid redundant calculation of the molecular descriptors and
-				// evaluation of the SVM
-				size_t pos {0};
-				KmerOffset koff(mFseqs[fsIdx], koff_offset, koff_size, true);
-				const auto& kmer = koff.getKmer();
+			for (size_t i = 0; i < mFseqs.size(); ++i)
+				begins[i + 1] += begins[i];
 
-				while ((pos = fs.getSeq().find(kmer, pos)) != std::string::npos) {
+			std::vector<KmerOffset> grouped(mAmpOccs.size());
 
-					refKmers.emplace_back(std::make_shared<KmerOffset>(fs, pos, koff.getSize(), true));
-					++pos;
-				}
+			for (const auto& koff : mAmpOccs)
+				grouped[begins[koff.getSeqIdx()]++] = koff;
 
-				inFile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			mAmpOccs.swap(grouped);
+		}
 
-			} // End of while (inFile >>...)
+		// Evaluate (predict) the given k-mers of size "ksize". If an exporter is given, the molecular
+		// descriptors of the k-mers are also written out in blocks (one per range of k-mers)
+		template<typename T, typename M, EnableIf<std::is_floating_point<T>>...>
+		bool evaluateKmers(std::vector<KmerOffset>& kmers, uint ksize, SvmScaling<T>& scaling,
+		                   M& model, const md::DescriptorSet<T>* mdset, KmerCache<T>* cache,
+		                   MdsWriter<T>* exporter) {
 
-			inFile.close();
+			if (exporter == nullptr) {
+				tbb::parallel_for_each(kmers.begin(), kmers.end(), [&] (auto& koff) {
+					koff.evaluate(mFseqs, scaling, model, mdset, cache);
+				});
 
-		}
+				return true;
+			}
 
-		void reduceKoffs(const FastaSeq& fs, tbb::concurrent_vector<std::shared_ptr<KmerOffset>>& kmers,
-		                 tbb::concurrent_vector<GroupKoff>& groups) {
+			// All the k-mers have the same size, so each one takes (ksize + 1) bytes in the k-mers file
+			auto block = exporter->reserve(kmers.size(), kmers.size() * (ksize + 1));
+			auto numCols = exporter->getNumCols();
+			std::atomic<bool> allOK {true};
 
-			if (kmers.empty())
-				return;
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, kmers.size(), 1'024), [&] (const auto& r) {
+
+				std::vector<T> rows(r.size() * numCols);
+				std::string kmersBuff;
+				kmersBuff.reserve(r.size() * (ksize + 1));
+
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					auto& koff = kmers[i];
+					koff.evaluate(mFseqs, scaling, model, mdset, cache, &rows[(i - r.begin()) * numCols]);
+					kmersBuff.append(koff.data(mFseqs), ksize);
+					kmersBuff += '\n';
+				}
 
-			// Sort k-mers by start position (offset)
-			tbb::parallel_sort(kmers.begin(), kmers.end(), [&] (const auto& ki, const auto& kj) {
-				return ki->getOffset() < kj->getOffset();
+				if (!exporter->writeRows(block.firstRow + r.begin(), rows.data(), r.size()) ||
+						!exporter->writeKmers(block.firstByte + r.begin() * (ksize + 1), kmersBuff.data(),
+						                      kmersBuff.size())) {
+					allOK = false;
+				}
 			});
 
+			return allOK;
+		}
 
-			auto totKmers = kmers.size();
-			std::shared_ptr<KmerOffset> kprev = kmers[0];
-			std::shared_ptr<KmerOffset> klast = kmers[0];
+		// Find (in "mAmpOccs") the occurrences of the AMPs (kept in memory) with a single scan of
+		// every sequence
+		void scanAmpOccurrences() {
+			std::vector<KmerOffset> amps;
 
-			// first    => start/offset
-			// second   => end
-			std::pair<size_t, size_t> kgc = std::make_pair(kprev->getOffset(), kprev->getSize());
-			size_t j = 1;
+			for (const auto& pair : mKmersMap)
+				amps.insert(amps.end(), pair.second.cbegin(), pair.second.cend());
 
-			while (j < totKmers) {
-				kgc.second = klast->getEnd();
-				std::shared_ptr<KmerOffset> kj = kmers[j];
+			KmerScanner scanner(mFseqs, amps);
+			std::vector<KmerOffset>().swap(amps);
 
-				if (!kj->isInside(kgc)) {
+			mAmpOccs = scanner.occurrences(mFseqs);
+		}
 
-					if (kj->isConnected(kgc) || kj->intersect(kgc)) {
-						klast = kj;
-					} else {
-						//groups.emplace_back(kgc.first, kgc.second);
-						groups.emplace_back(fs, kgc.first, kgc.second);
-						kprev = kj;
-						klast = kj;
-						kgc.first = kprev->getOffset();
-					}
-				}
+		// Group the overlapped AMP k-mers [first, last) of a sequence: the residues covered by
+		// them are marked in "coverage" and every covered region becomes a group
+		void reduceKoffs(const KmerOffset* first, const KmerOffset* last, CoverageBitmap& coverage,
+		                 std::vector<GroupKoff>& groups) const {
 
-				j++;
-			}
+			auto fsIdx = first->getSeqIdx();
+			coverage.reset(mFseqs[fsIdx].length());
 
-			if (kprev->getOffset() != klast->getOffset() && kprev->getEnd() != klast->getEnd())
-				groups.emplace_back(fs, kprev->getOffset(), klast->getEnd());
-			else
-				groups.emplace_back(fs, klast->getOffset(), klast->getEnd());
+			for (auto koff = first; koff != last; ++koff)
+				coverage.mark(koff->getOffset(), koff->getEnd());
 
+			reduceCoverage(fsIdx, coverage, groups);
 		}
 
-		size_t reduceGroups(tbb::concurrent_vector<GroupKoff>& groups) {
+		// Every covered region of the sequence "fsIdx" becomes a group. Regions separated by a
+		// single uncovered residue are joined into the same group.
+		void reduceCoverage(size_t fsIdx, const CoverageBitmap& coverage, std::vector<GroupKoff>& groups) const {
+			coverage.regions(1, [&] (size_t begin, size_t end) {
+				groups.emplace_back(mFseqs, fsIdx, begin, end);
+			});
+		}
 
-			// Sort by k-mer content (sequence)
-			tbb::parallel_sort(groups);
+		// Remove the repeated groups (by content), keeping the groups in the order of the sequences.
+		// Only the groups with the same hash are compared and, between equal groups, the one of the
+		// first sequence (and lowest offset) is kept
+		size_t reduceGroups(std::vector<GroupKoff>& groups) {
 
-			// Get the iterator ("index") past the end of the last unique group
-			auto last = std::unique(groups.begin(), groups.end());
+			// Order of the sequences (the groups of every sequence are already in order)
+			tbb::parallel_sort(groups.begin(), groups.end(), [] (const auto& gi, const auto& gj) {
+				return (gi.getSeqIdx() != gj.getSeqIdx()) ? gi.getSeqIdx() < gj.getSeqIdx()
+				                                          : gi.getBegin() < gj.getBegin();
+			});
 
-			// Get the distance in order to calculate the total of uniques groups
-			return static_cast<size_t>(std::distance(groups.begin(), last));
-		}
+			// Groups with the same hash end up together, in the order of the sequences
+			std::vector<std::pair<uint64_t, uint32_t>> byHash(groups.size());
 
-		void writeGroups(std::ofstream& fout, tbb::concurrent_vector<GroupKoff>& groups, size_t totUniqs) const {
+			tbb::parallel_for(size_t {0}, groups.size(), [&] (size_t i) {
+				byHash[i] = std::make_pair(groups[i].getHash(), static_cast<uint32_t>(i));
+			});
 
-			if (groups.empty())
-				return;
+			tbb::parallel_sort(byHash.begin(), byHash.end());
 
-			for (size_t i {0}; i < totUniqs; ++i) {
+			// A group is kept unless an equal one precedes it (each run of equal hashes is checked
+			// by the range where it starts)
+			std::vector<uint8_t> keep(groups.size(), 1);
 
-				const auto& g = groups[i];
-				const auto& fs = g.getFastaSeq();
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, byHash.size()), [&] (const auto& r) {
+				std::vector<uint32_t> kept;
 
-				const auto& desc = fs.getDesc();
-				const auto& fseq = fs.getSeq();
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					if (i > 0 && byHash[i - 1].first == byHash[i].first)
+						continue;
 
-				const auto begin = g.getBegin();
-				const auto end = g.getEnd() > 0 ? g.getEnd() - 1 : g.getEnd();
+					kept.assign(1, byHash[i].second);
 
-				const auto len = g.getEnd() - begin;
-				const auto header = ">" + desc + "_" + std::to_string(begin) + "_" + std::to_string(end);
+					for (auto j = i + 1; j < byHash.size() && byHash[j].first == byHash[i].first; ++j) {
+						const auto& gj = groups[byHash[j].second];
 
-				fout << header << "\n" << fseq.substr(begin, len) << "\n";
-			}
+						auto repeated = std::any_of(kept.cbegin(), kept.cend(), [&] (uint32_t k) {
+							return groups[k].equals(mFseqs, gj);
+						});
+
+						if (repeated)
+							keep[byHash[j].second] = 0;
+						else
+							kept.push_back(byHash[j].second);
+					}
+				}
+			});
 
+			std::vector<std::pair<uint64_t, uint32_t>>().swap(byHash);
+
+			// Parallel (stable) compaction of the kept groups, by blocks
+			constexpr size_t blockSize {16'384};
+			auto numBlocks = (groups.size() + blockSize - 1) / blockSize;
+			std::vector<size_t> offsets(numBlocks + 1, 0);
+
+			tbb::parallel_for(size_t {0}, numBlocks, [&] (size_t b) {
+				auto last = std::min(groups.size(), (b + 1) * blockSize);
+				offsets[b + 1] = static_cast<size_t>(std::count(keep.cbegin() + b * blockSize, keep.cbegin() + last, 1));
+			});
+
+			for (size_t b = 0; b < numBlocks; ++b)
+				offsets[b + 1] += offsets[b];
+
+			std::vector<GroupKoff> uniqs(offsets.back());
+
+			tbb::parallel_for(size_t {0}, numBlocks, [&] (size_t b) {
+				auto out = offsets[b];
+
+				for (auto i = b * blockSize; i < std::min(groups.size(), (b + 1) * blockSize); ++i) {
+					if (keep[i])
+						uniqs[out++] = groups[i];
+				}
+			});
+
+			groups.swap(uniqs);
+			return groups.size();
+		}
+
+		bool writeGroups(FastaWriter& fout, const std::vector<GroupKoff>& groups, size_t totUniqs) const {
+			return fout.write(totUniqs, [&] (size_t i) {
+				const auto& g = groups[i];
+				return FastaRecord {g.getSeqIdx(), g.getBegin(), g.getEnd(), 0};
+			});
 		}
 
 		std::string generateTmpBaseName() const {
@@ -586,13 +855,14 @@ namespace fasta {
 
 		}
 
-		std::pair<bool, std::string> writePreds(tbb::concurrent_vector<KmerOffset>& kmers) {
+		std::pair<bool, std::string> writePreds(std::vector<KmerOffset>& kmers, bool append = false) {
 
 			bool allOK = true;
 			std::string error;
 
+			// Nothing to write (e.g. all the k-mers of the batch were dropped)
 			if (kmers.empty())
-				return std::make_pair(false, "Error: empty kmers to write");
+				return std::make_pair(true, std::string());
 
 			auto ksizeStr = std::to_string(kmers[0].size());
 			auto lastDotIdx = mOutFileName.find_last_of('.');
@@ -612,7 +882,7 @@ namespace fasta {
 					          << "Writing " + ksizeStr + "-mers predicteds as AMPs" << std::endl;
 				}
 
-				auto okErrAMPs = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_AMPS_PREDS);
+				auto okErrAMPs = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_AMPS_PREDS, append);
 
 				if (!okErrAMPs.first) {
 					std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
@@ -626,7 +896,7 @@ namespace fasta {
 					          << "Writing " + ksizeStr + "-mers predicteds as No-AMPs" << std::endl;
 				}
 
-				auto okErrNAMPs = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_NAMPS_PREDS);
+				auto okErrNAMPs = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_NAMPS_PREDS, append);
 
 				if (!okErrNAMPs.first) {
 					std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
@@ -643,7 +913,7 @@ namespace fasta {
 					          << "Writing " + ksizeStr + "-mers predicteds as AMPs" << std::endl;
 				}
 
-				auto okErr = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_AMPS_PREDS);
+				auto okErr = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_AMPS_PREDS, append);
 
 				if (!okErr.first) {
 					std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
@@ -660,7 +930,7 @@ namespace fasta {
 					          << "Writing " + ksizeStr + "-mers predicteds as No-AMPs" << std::endl;
 				}
 
-				auto okErr = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_NAMPS_PREDS);
+				auto okErr = writePreds(kmers, ksizeStr, fileBaseName, Globals::WRITE_NAMPS_PREDS, append);
 
 				if (!okErr.first) {
 					std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
@@ -672,16 +942,16 @@ namespace fasta {
 			return std::make_pair(allOK, error);
 		}
 
-		std::pair<bool, std::string> writePreds(tbb::concurrent_vector<KmerOffset> &kmers,
+		std::pair<bool, std::string> writePreds(std::vector<KmerOffset> &kmers,
 		                                        std::string& ksizeStr,
-		                                        std::string &fileBaseName, uint toWrite) {
+		                                        std::string &fileBaseName, uint toWrite, bool append) {
 
 			bool allOK = true;
 			std::string error;
 			std::string fname;
 			std::string msgErr;
-			tbb::concurrent_vector<KmerOffset>::const_iterator beginItr;
-			tbb::concurrent_vector<KmerOffset>::const_iterator endItr;
+			std::vector<KmerOffset>::const_iterator beginItr;
+			std::vector<KmerOffset>::const_iterator endItr;
 
 			if (toWrite == Globals::WRITE_AMPS_PREDS) {
 				fname = fileBaseName + "_" + ksizeStr + "-mers_amps.fasta";
@@ -704,27 +974,18 @@ namespace fasta {
 				endItr = kmers.cend();
 			}
 
-			std::ofstream fout (fname, std::ios_base::trunc | std::ios_base::out);
-
-			for (auto i = beginItr; i < endItr; ++i) {
-				const auto& koff = *i;
-				auto header = ">" + koff.getFastaSeq().getDesc() + "_" +
-						std::to_string(koff.getOffset()) + "_" + std::to_string(koff.getEnd() - 1) + "\n";
+			FastaWriter fout(mFseqs);
 
-				auto seq = koff.getKmer() + "\n";
-
-				fout << header << seq;
+			auto written = fout.open(fname, append) && fout.write(static_cast<size_t>(endItr - beginItr), [&] (size_t i) {
+				const auto& koff = beginItr[i];
+				return FastaRecord {koff.getSeqIdx(), koff.getOffset(), koff.getEnd(), koff.getCount()};
+			});
 
-				if (fout.bad() || fout.fail()) {
-					allOK = false;
-					error = "Unable to write " + ksizeStr + "-mers predicteds " +  msgErr + fname;
-					break;
-				}
+			if (!fout.close() || !written) {
+				allOK = false;
+				error = "Unable to write " + ksizeStr + "-mers predicteds " +  msgErr + fname;
 			}
 
-			fout.flush();
-			fout.close();
-
 			return std::make_pair(allOK, error);
 
 		}
@@ -735,10 +996,18 @@ namespace fasta {
 		uint mLowerKSize;
 		uint mUpperKSize;
 		uint mWritePreds;
-		tbb::concurrent_vector<FastaSeq> mFseqs;
-		tbb::concurrent_unordered_map<uint, std::string> mTmpFiles;
-		tbb::concurrent_unordered_map<uint, tbb::concurrent_vector<KmerOffset>> mKmersMap;
+		FastaSeqs mFseqs;
+		KmerSpills mSpills;                 // Occurrences of the AMPs (in memory or spilled)
+		MemoryPlan mPlan;
+		tbb::concurrent_unordered_map<uint, std::vector<KmerOffset>> mKmersMap;
 		bool mAwareMode;
+		bool mSeqMajor;
+		bool mFusedMode;
+		size_t mMemoryLimit;    // Memory budget (in bytes) of the extraction and the shrinking (0 = none)
+		uint mMinOccurrences;   // K-mers with less occurrences are not evaluated
+		bool mKeepOccurrences {false};
+		std::vector<KmerOffset> mAmpOccs;   // All the occurrences of the AMPs (sequence-major mode)
+		ProteomeCoverage mCoverage;         // Residues covered by the AMPs (fused mode)
 		bool mVerbose;
 
 	};
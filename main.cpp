@@ -34,6 +34,12 @@ int main(int argc, char *argv[]) {
 		if (ec != 1)
 			exit(ec);
 
+		// Molecular descriptors set: the built-in one or loaded from file
+		md::DescriptorSet<MD_T> mdset;
+
+		if (!cli.getDescriptorsFile().empty())
+			mdset.load(cli.getDescriptorsFile());
+
 		SvmScaling<MD_T> scaling;
 		auto scalingLoaded = scaling.restore(cli.getScalingFile());
 
@@ -43,6 +49,13 @@ int main(int argc, char *argv[]) {
 			return 0;
 		}
 
+		if (scaling.size() != mdset.size()) {
+			cerr << style::bold << fg::red<< "[ERROR] " << style::reset << fg::red
+			     << "SVM's scaling file has " << scaling.size() << " features, but the descriptors set has "
+			     << mdset.size() << endl;
+			return 0;
+		}
+
 #ifdef USE_LIBSVM
 
 		shared_ptr<svm_model> model (svm_load_model(cli.getModelFile().c_str()));
@@ -54,7 +67,7 @@ int main(int argc, char *argv[]) {
 		}
 #else
 		SvmModel<MD_T> model;
-		auto modelLoaded = model.load(cli.getModelFile());
+		auto modelLoaded = model.load(cli.getModelFile(), mdset.size());
 
 		if (!modelLoaded) {
 			cerr << style::bold << fg::red << "[ERROR] " << style::reset << fg::red
@@ -62,6 +75,21 @@ int main(int argc, char *argv[]) {
 			return 0;
 		}
 #endif
+		// Cache of molecular descriptors and predictions (optional)
+		KmerCache<MD_T> cache;
+
+		if (!cli.getCacheFile().empty()) {
+			auto checksum = KmerCache<MD_T>::fileChecksum(cli.getModelFile(),
+			                                              KmerCache<MD_T>::fileChecksum(cli.getScalingFile()));
+
+			if (!cache.open(cli.getCacheFile(), cli.getCacheSize() * 1024 * 1024, checksum, mdset.size(),
+			                mdset.checksum())) {
+				std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
+				          << (cache.isInUse() ? "The cache file is in use by another run: " : "Unable to open the cache file: ")
+				          << cli.getCacheFile() << ". Running without cache" << style::reset << std::endl;
+			}
+		}
+
         if (cli.getNumThreads() == -1) {
             std::cout << style::bold << fg::yellow << "[WARNING] " << style::reset << fg::yellow
                       << "Number of threads set to: automatic" << std::endl;
@@ -70,27 +98,86 @@ int main(int argc, char *argv[]) {
 		// Initialize the task scheduler
 		tbb::task_scheduler_init init (cli.getNumThreads());
 
+		// Memory limit (in bytes) of the extraction of the k-mers (0 = none)
+		auto memoryLimit = cli.getMemoryLimit() * 1024 * 1024;
+
 		KmersManager km(cli.getInputFile(),     // Input file - proteome file
 		                cli.getOutputFile(),    // Output file - shrinked proteome
 		                cli.getLowerKmer(),     // Lower k-mer size
 		                cli.getUpperKmer(),     // Upper k-mer size
 		                cli.getWritePreds(),    // Write predicteds k-mers (AMPs, NAMPs, boths, none)
 		                cli.hasAwareMode(),     // Aware mode ==> low-memory consumption
+		                cli.hasSeqMajorMode(),  // Sequence-major mode ==> all k-mer sizes in one traversal
+		                cli.hasFusedMode(),     // Fused mode ==> shrink while extracting
+		                memoryLimit,            // Memory limit ==> partitioned (on-disk) extraction
+		                cli.getMinOccurrences(), // Minimum occurrences of the k-mers to evaluate
 						cli.hasVerboseMode());  // Has verbose mode enabled? ==> show extra information
 
+		// Exporter of molecular descriptors (optional)
+		MdsWriter<MD_T> exporter;
+
+		if (!cli.getExportFile().empty() && !exporter.open(cli.getExportFile(), mdset.size())) {
+			cerr << style::bold << fg::red << "[ERROR] " << style::reset << fg::red
+			     << "Unable to open the export file: " << cli.getExportFile() << endl;
+			return 1;
+		}
+
+		//
+		// Exporting peptides' molecular descriptors (no extraction, nor shrinking)
+		//
+		if (cli.hasPeptidesMode()) {
+			cout << endl << style::bold << fg::green << "[STATUS] " << style::reset << fg::green
+			     << "Exporting molecular descriptors..." << endl;
+
+			auto okErr = km.exportPeptides(exporter, &mdset);
+
+			if (!exporter.close() || !okErr.first) {
+				cerr << style::bold << fg::red << "[ERROR] " << style::reset << fg::red
+				     << (okErr.first ? "Error while writing the export file" : okErr.second) << endl;
+				return 1;
+			}
+
+			cout << style::bold << fg::green << "[DONE]" << style::reset << endl;
+			return 0;
+		}
+
 		//
 		// Extracting k-mers
 		//
 		cout << endl << style::bold << fg::green << "[STATUS] " << style::reset << fg::green
 		     <<"Extracting k-mers..." << endl;
 
-		auto okErr = km.extract(scaling, model);
+		auto okErr = km.extract(scaling, model, &mdset, cache.isOpen() ? &cache : nullptr,
+		                        exporter.isOpen() ? &exporter : nullptr);
 
 		if (!okErr.first) {
             cerr << style::bold << fg::red << "[ERROR] " << style::reset << fg::red << okErr.second << endl;
 			return 1;
 		}
 
+		if (exporter.isOpen()) {
+			auto numRows = exporter.getNumRows();
+
+			if (!exporter.close()) {
+				cerr << style::bold << fg::red << "[ERROR] " << style::reset << fg::red
+				     << "Error while writing the export file: " << cli.getExportFile() << endl;
+				return 1;
+			}
+
+			if (cli.hasVerboseMode()) {
+				cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+				     << "Exported the molecular descriptors of " << numRows << " k-mers to file: "
+				     << cli.getExportFile() << endl;
+			}
+		}
+
+		if (cache.isOpen() && cli.hasVerboseMode()) {
+			cout << style::bold << fg::blue << "[INFO] " << style::reset << fg::blue
+			     << "Cache hits: " << cache.getHits() << ", misses: " << cache.getMisses() << endl;
+		}
+
+		cache.close();
+
 		//
 		// Shrinking proteome
 		//
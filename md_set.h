@@ -0,0 +1,641 @@
+#ifndef INPROT_MD_SET_H
+#define INPROT_MD_SET_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#include "md.h"
+
+template <typename Condition>
+using EnableIf = typename std::enable_if<Condition::value>::type;
+
+namespace md {
+
+	// Definition of the 51 molecular descriptors calculated by "KmerOffset::calculateMD", in
+	// the same order than "md::MDS". It is the default descriptors set.
+	//
+	// Format (one descriptor per line, '#' starts a comment):
+	//      length
+	//      netcharge [ph]
+	//      hmoment [angle window]
+	//      average <scale>
+	//      sum <scale>
+	//      composition <alphabet> <class>
+	//      distribution <alphabet> <class> <percentage>
+	//      transition <alphabet> <class> <class>
+	//      tripeptide <alphabet> <class> <class> <class>
+	const std::string DEFAULT_MDS_SPEC = R"(
+length
+composition Std F
+netcharge
+distribution NormVWTomii MHKFRYW 50
+composition Std M
+distribution NormVWTomii NVEQIL 75
+composition Std Q
+hmoment
+distribution PolarityTomii PATGS 0
+distribution PolarityTomii LIFWCMVY 0
+average Klein
+distribution PolarityTomii HQRKNED 25
+sum ChartonCTDC
+average KuhnHydrov
+average CID2
+average CID4
+average CID5
+average ManavalanPonnuswamy
+average Ponnuswamy5
+distribution PolarizabilityTomii GASDT 75
+average Prabhakaran
+average SweetEisenberg
+distribution PolarizabilityTomii GASDT 100
+average Zimmerman
+average Wolfenden
+average CasariSippl
+average Tossi
+distribution SecondStructTomii EALMQKRH 50
+distribution SecondStructTomii EALMQKRH 100
+composition Blosum50 CLVIM
+distribution ChargeTomii DE 0
+composition Blosum50 FWY
+distribution ChargeTomii KR 100
+composition NormVWTomii MHKFRYW
+distribution SolventAccTomii ALFCGIVW 0
+distribution SolventAccTomii MPSTHY 0
+distribution SolventAccTomii RKQEND 0
+distribution SolventAccTomii RKQEND 25
+composition PolarizabilityTomii KMHFRYW
+composition ChargeTomii DE
+composition ChargeTomii KR
+composition SecondStructTomii VIYCWFT
+composition SolventAccTomii ALFCGIVW
+transition HydrophobicityTomii CLVIMFW RKEDQN
+tripeptide HydrophobicityTomii RKEDQN CLVIMFW GASTPHY
+tripeptide HydrophobicityTomii CLVIMFW CLVIMFW GASTPHY
+transition SolventAccTomii ALFCGIVW RKQEND
+distribution HydrophobicityTomii GASTPHY 0
+distribution HydrophobicityTomii CLVIMFW 0
+tripeptide HydrophobicityTomii CLVIMFW CLVIMFW CLVIMFW
+distribution HydrophobicityTomii GASTPHY 75
+)";
+
+
+	// Set of molecular descriptors loaded from a specification (see "DEFAULT_MDS_SPEC") and
+	// lowered into flat tables indexed by residue, so all the descriptors of a k-mer are
+	// calculated together in (at most) two passes over the k-mer (plus the hydrophobic
+	// moment's windows). The values are the same than those of the functions in "md.h".
+	template<typename T, EnableIf<std::is_floating_point<T>>...>
+	class DescriptorSet {
+
+		enum class Kind: uint8_t { LENGTH, NET_CHARGE, HMOMENT, AVERAGE, SUM, COMPOSITION, DISTRIBUTION,
+			TRANSITION, TRIPEPTIDE };
+
+		// Type of the terms of the net charge, as in "md::netCharge"
+		using ChargeT = decltype(1 / (1 + std::pow(10, std::declval<T>())));
+
+		struct Descriptor {
+			Kind kind;
+			uint8_t scale;                  // AVERAGE, SUM
+			std::array<uint8_t, 3> cls;     // COMPOSITION, DISTRIBUTION, TRANSITION, TRIPEPTIDE
+			T percentage;                   // DISTRIBUTION
+		};
+
+		static constexpr size_t NUM_CHARS = 256;
+		static constexpr size_t MAX_CLASSES = 64;
+		// The scratch buffers of "calculate" are sized by this limit (scales, transitions, tripeptides
+		// and distributions are at most one per descriptor), so no memory is allocated per k-mer
+		static constexpr size_t MAX_DESCS = 256;
+
+	public:
+		//
+		// Constructors
+		//
+		DescriptorSet() {
+			compile(DEFAULT_MDS_SPEC);
+		}
+
+		//
+		// Methods
+		//
+
+		// Load the descriptors set from the given file. Throws if the specification is invalid
+		void load(const std::string& filename) {
+			std::ifstream inFile(filename, std::ios_base::in | std::ios_base::binary);
+
+			if (!inFile)
+				throw std::runtime_error("Unable to open the descriptors file: " + filename);
+
+			std::stringstream ss;
+			ss << inFile.rdbuf();
+			compile(ss.str());
+		}
+
+		size_t size() const {
+			return mDescs.size();
+		}
+
+		// Checksum of the (normalized) specification. Two sets with the same checksum calculate
+		// the same descriptors
+		uint64_t checksum() const {
+			return mChecksum;
+		}
+
+		// Calculate all the descriptors of the k-mer "seq" (of length "len") into "mds"
+		void calculate(const char* seq, size_t len, T* mds) const noexcept {
+
+			std::array<size_t, NUM_CHARS> hist {};
+			std::array<T, MAX_DESCS> sums;
+			std::array<size_t, MAX_DESCS> pairs;
+			std::array<size_t, MAX_DESCS> triplets;
+			std::fill_n(sums.begin(), mNumScales, T {0});
+			std::fill_n(pairs.begin(), mPairDescs.size(), size_t {0});
+			std::fill_n(triplets.begin(), mTripDescs.size(), size_t {0});
+			uint64_t prev2 {0};
+			uint64_t prev1 {0};
+
+			//
+			// 1st pass: residues' histogram, scales' sums, transitions and tripeptides
+			//
+			for (size_t i = 0; i < len; ++i) {
+				auto c = static_cast<unsigned char>(seq[i]);
+				auto curr = mClassMask[c];
+				const auto* values = &mScaleTable[c * mNumScales];
+
+				++hist[c];
+
+				for (size_t s = 0; s < mNumScales; ++s)
+					sums[s] += values[s];
+
+				if (i > 0) {
+					for (size_t p = 0; p < mPairDescs.size(); ++p) {
+						const auto& cls = mDescs[mPairDescs[p]].cls;
+
+						if (cls[0] != cls[1] && ((hasCls(prev1, cls[0]) && hasCls(curr, cls[1])) ||
+								(hasCls(prev1, cls[1]) && hasCls(curr, cls[0]))))
+							++pairs[p];
+					}
+				}
+
+				if (i > 1) {
+					for (size_t t = 0; t < mTripDescs.size(); ++t) {
+						const auto& cls = mDescs[mTripDescs[t]].cls;
+
+						if (hasCls(prev2, cls[0]) && hasCls(prev1, cls[1]) && hasCls(curr, cls[2]))
+							++triplets[t];
+					}
+				}
+
+				prev2 = prev1;
+				prev1 = curr;
+			}
+
+			// Total of residues of each class
+			std::array<size_t, MAX_CLASSES> clsCount {};
+			for (size_t k = 0; k < mClasses.size(); ++k) {
+				for (auto r : mClasses[k])
+					clsCount[k] += hist[static_cast<unsigned char>(r)];
+			}
+
+			//
+			// Descriptors that only depend on the 1st pass
+			//
+			size_t p {0};
+			size_t t {0};
+			std::array<size_t, MAX_DESCS> pending;
+			size_t numPending {0};
+
+			for (size_t d = 0; d < mDescs.size(); ++d) {
+				const auto& desc = mDescs[d];
+
+				switch (desc.kind) {
+					case Kind::LENGTH:
+						mds[d] = static_cast<T>(len);
+						break;
+
+					case Kind::NET_CHARGE:
+						mds[d] = netCharge(hist);
+						break;
+
+					case Kind::HMOMENT:
+						mds[d] = hMoment(seq, len);
+						break;
+
+					case Kind::AVERAGE:
+						mds[d] = sums[desc.scale] / len;
+						break;
+
+					case Kind::SUM:
+						mds[d] = sums[desc.scale];
+						break;
+
+					case Kind::COMPOSITION:
+						mds[d] = composition(clsCount[desc.cls[0]], len);
+						break;
+
+					case Kind::TRANSITION:
+						mds[d] = (static_cast<T>(pairs[p++]) / (len - 1)) * 100;
+						break;
+
+					case Kind::TRIPEPTIDE:
+						mds[d] = (static_cast<T>(triplets[t++]) / (len - 2)) * 100;
+						break;
+
+					case Kind::DISTRIBUTION:
+						pending[numPending++] = d;
+						break;
+				}
+			}
+
+			if (numPending == 0)
+				return;
+
+			//
+			// 2nd pass (only if needed): distributions. The target is the number of residues of
+			// the class that must be seen (as in "md::distributionReduceAlph")
+			//
+			std::array<size_t, MAX_DESCS> targets;
+
+			size_t unresolved {0};
+			for (size_t j = 0; j < numPending; ++j) {
+				auto d = pending[j];
+				const auto& desc = mDescs[d];
+				auto comp = composition(clsCount[desc.cls[0]], len);
+				auto nRa = 0;
+
+				if (desc.percentage > 0) {
+					nRa = static_cast<int>(std::round((comp * len) / 100));
+					nRa = static_cast<int>(std::round((nRa * desc.percentage) / 100));
+				}
+
+				// Defaults: no residue of the class found
+				mds[d] = (nRa == 0 && desc.percentage > 0) ? 0 : comp;
+
+				if (nRa == 0 && desc.percentage > 0) {
+					targets[j] = 0;
+				} else {
+					targets[j] = (desc.percentage == 0) ? 1 : static_cast<size_t>(nRa);
+					++unresolved;
+				}
+			}
+
+			std::array<size_t, MAX_CLASSES> seen {};
+
+			for (size_t i = 0; i < len && unresolved > 0; ++i) {
+				auto curr = mClassMask[static_cast<unsigned char>(seq[i])];
+
+				if (curr == 0)
+					continue;
+
+				for (size_t k = 0; k < mClasses.size(); ++k)
+					seen[k] += hasCls(curr, static_cast<uint8_t>(k)) ? 1 : 0;
+
+				for (size_t j = 0; j < numPending; ++j) {
+					auto cls = mDescs[pending[j]].cls[0];
+
+					if (targets[j] != 0 && hasCls(curr, cls) && seen[cls] == targets[j]) {
+						mds[pending[j]] = (static_cast<T>(i + 1) / len) * 100;
+						targets[j] = 0;
+						--unresolved;
+					}
+				}
+			}
+
+		}
+
+
+	private:
+		//
+		// Private methods
+		//
+		static bool hasCls(uint64_t mask, uint8_t cls) noexcept {
+			return ((mask >> cls) & 1) != 0;
+		}
+
+		static T composition(size_t count, size_t len) noexcept {
+			return static_cast<T>((static_cast<T>(count) / len) * 100);
+		}
+
+		// Same as "md::netCharge", with the terms added in the same order
+		T netCharge(const std::array<size_t, NUM_CHARS>& hist) const noexcept {
+			T pos {0};
+			T neg {0};
+
+			for (const auto& term : mPosCharges) {
+				auto count = static_cast<T>(hist[static_cast<unsigned char>(term.first)] + (term.first == '#' ? 1 : 0));
+				if (count != 0)
+					pos += count * term.second;
+			}
+
+			for (const auto& term : mNegCharges) {
+				auto count = static_cast<T>(hist[static_cast<unsigned char>(term.first)] + (term.first == '@' ? 1 : 0));
+				if (count != 0)
+					neg += count * term.second;
+			}
+
+			return pos + neg;
+		}
+
+		// Same as "md::hMoment", with the sines and cosines looked up in tables
+		T hMoment(const char* seq, size_t len) const noexcept {
+
+			if (mHmmWindow == 0)
+				return 0;
+
+			if (mHmmWindow > len)
+				return -1;
+
+			T sumHmSin {0};
+			T sumHmCos {0};
+			T hmMax {std::numeric_limits<T>::lowest()};
+			T hM {0};
+
+			for (size_t i = 0, j = len - mHmmWindow + 1; i < j; ++i) {
+				for (size_t k = i, r = (mHmmWindow + i); k < r; ++k) {
+					T hv {mHmmScale[static_cast<unsigned char>(seq[k])]};
+					auto n = k + i + 1;
+
+					if (n < mSin.size()) {
+						sumHmSin += hv * mSin[n];
+						sumHmCos += hv * mCos[n];
+					} else {
+						T rads {toRadians<T>(mHmmAngle * n)};
+						sumHmSin += hv * std::sin(rads);
+						sumHmCos += hv * std::cos(rads);
+					}
+				}
+
+				hM = std::sqrt(std::pow(sumHmSin, 2) + std::pow(sumHmCos, 2)) / mHmmWindow;
+
+				if (hM > hmMax)
+					hmMax = hM;
+
+				sumHmSin = {0};
+				sumHmCos = {0};
+			}
+
+			return hmMax;
+		}
+
+		// Parse the specification and build the tables
+		void compile(const std::string& spec) {
+			std::vector<Descriptor> descs;
+			std::vector<std::string> scaleNames;
+			std::vector<std::string> classes;
+			std::string normalized;
+
+			mHmmAngle = Globals::HMM_ANGLE;
+			mHmmWindow = Globals::HMM_WINDOW_SIZE;
+			int ph = Globals::PH_NET_CHARGE;
+
+			std::istringstream input(spec);
+			std::string line;
+			size_t numLine {0};
+
+			while (std::getline(input, line)) {
+				++numLine;
+
+				auto comment = line.find('#');
+				if (comment != std::string::npos)
+					line.erase(comment);
+
+				std::istringstream tokens(line);
+				std::vector<std::string> args;
+				std::string tok;
+
+				while (tokens >> tok)
+					args.emplace_back(tok);
+
+				if (args.empty())
+					continue;
+
+				auto error = [&] (const std::string& msg) {
+					return std::runtime_error("Descriptors specification, line " + std::to_string(numLine) +
+					                          ": " + msg);
+				};
+
+				auto nargs = args.size() - 1;
+				const auto& name = args[0];
+				Descriptor desc {Kind::LENGTH, 0, {{0, 0, 0}}, 0};
+
+				if (name == "length" && nargs == 0) {
+					desc.kind = Kind::LENGTH;
+
+				} else if (name == "netcharge" && nargs <= 1) {
+					desc.kind = Kind::NET_CHARGE;
+					if (nargs == 1)
+						ph = std::stoi(args[1]);
+
+				} else if (name == "hmoment" && (nargs == 0 || nargs == 2)) {
+					desc.kind = Kind::HMOMENT;
+					if (nargs == 2) {
+						mHmmAngle = static_cast<uint>(std::stoul(args[1]));
+						mHmmWindow = static_cast<uint>(std::stoul(args[2]));
+					}
+
+				} else if ((name == "average" || name == "sum") && nargs == 1) {
+					if (scaleOf(args[1]) == nullptr)
+						throw error("unknown scale: " + args[1]);
+
+					auto found = std::find(scaleNames.begin(), scaleNames.end(), args[1]);
+					desc.kind = (name == "average") ? Kind::AVERAGE : Kind::SUM;
+					desc.scale = static_cast<uint8_t>(std::distance(scaleNames.begin(), found));
+
+					if (found == scaleNames.end())
+						scaleNames.emplace_back(args[1]);
+
+				} else if ((name == "composition" && nargs == 2) || (name == "distribution" && nargs == 3) ||
+						(name == "transition" && nargs == 3) || (name == "tripeptide" && nargs == 4)) {
+
+					desc.kind = (name == "composition") ? Kind::COMPOSITION :
+					            (name == "distribution") ? Kind::DISTRIBUTION :
+					            (name == "transition") ? Kind::TRANSITION : Kind::TRIPEPTIDE;
+
+					auto numCls = (desc.kind == Kind::TRANSITION) ? 2 : (desc.kind == Kind::TRIPEPTIDE) ? 3 : 1;
+					const auto& alphabet = args[1];
+
+					for (auto c = 0; c < numCls; ++c) {
+						const auto& cls = args[2 + c];
+
+						if (!isClassOf(alphabet, cls))
+							throw error("unknown class \"" + cls + "\" of the reduced alphabet \"" + alphabet + "\"");
+
+						// Classes are identified by its residues
+						auto found = std::find(classes.begin(), classes.end(), cls);
+						desc.cls[c] = static_cast<uint8_t>(std::distance(classes.begin(), found));
+
+						if (found == classes.end())
+							classes.emplace_back(cls);
+					}
+
+					if (desc.kind == Kind::DISTRIBUTION) {
+						desc.percentage = static_cast<T>(std::stod(args[3]));
+
+						if (desc.percentage < 0 || desc.percentage > 100)
+							throw error("invalid percentage: " + args[3]);
+					}
+
+				} else {
+					throw error("invalid descriptor: " + line);
+				}
+
+				if (classes.size() > MAX_CLASSES)
+					throw error("too many classes (maximum = " + std::to_string(MAX_CLASSES) + ")");
+
+				if (descs.size() == MAX_DESCS)
+					throw error("too many descriptors (maximum = " + std::to_string(MAX_DESCS) + ")");
+
+				descs.emplace_back(desc);
+
+				for (const auto& a : args)
+					normalized += a + " ";
+
+				normalized += "\n";
+			}
+
+			if (descs.empty())
+				throw std::runtime_error("Descriptors specification without descriptors");
+
+			//
+			// Build the tables
+			//
+			mDescs = descs;
+			mClasses = classes;
+			mNumScales = scaleNames.size();
+			mScaleTable.assign(NUM_CHARS * mNumScales, 0);
+			mClassMask.fill(0);
+			mPairDescs.clear();
+			mTripDescs.clear();
+
+			for (size_t s = 0; s < scaleNames.size(); ++s) {
+				for (const auto& pair : *scaleOf(scaleNames[s]))
+					mScaleTable[static_cast<unsigned char>(pair.first) * mNumScales + s] = pair.second;
+			}
+
+			for (size_t k = 0; k < mClasses.size(); ++k) {
+				for (auto r : mClasses[k])
+					mClassMask[static_cast<unsigned char>(r)] |= (static_cast<uint64_t>(1) << k);
+			}
+
+			for (size_t d = 0; d < mDescs.size(); ++d) {
+				if (mDescs[d].kind == Kind::TRANSITION)
+					mPairDescs.emplace_back(d);
+
+				if (mDescs[d].kind == Kind::TRIPEPTIDE)
+					mTripDescs.emplace_back(d);
+			}
+
+			// Hydrophobic moment: scale and sines/cosines of the angles of the k-mers' sizes
+			mHmmScale.fill(0);
+			for (const auto& pair : scales::NormalizedEisenberg<T>)
+				mHmmScale[static_cast<unsigned char>(pair.first)] = pair.second;
+
+			mSin.assign(2 * Globals::MAX_KMER_SIZE + 1, 0);
+			mCos.assign(2 * Globals::MAX_KMER_SIZE + 1, 0);
+			for (size_t n = 0; n < mSin.size(); ++n) {
+				T rads {toRadians<T>(mHmmAngle * n)};
+				mSin[n] = std::sin(rads);
+				mCos[n] = std::cos(rads);
+			}
+
+			// Net charge: the terms in the same order than they are added by "md::netCharge"
+			std::unordered_map<char, T> nj {{'Y', 0}, {'D', 0}, {'E', 0}, {'C', 0}, {'@', 1}};
+			std::unordered_map<char, T> ni {{'R', 0}, {'H', 0}, {'K', 0}, {'#', 1}};
+			mPosCharges.clear();
+			mNegCharges.clear();
+
+			for (const auto& pair : ni) {
+				auto pKai = scales::IPC<T>.find(pair.first);
+				if (pKai != scales::IPC<T>.end())
+					mPosCharges.emplace_back(pair.first, (1 / (1 + std::pow(10, ph - pKai->second))));
+			}
+
+			for (const auto& pair : nj) {
+				auto pKai = scales::IPC<T>.find(pair.first);
+				if (pKai != scales::IPC<T>.end())
+					mNegCharges.emplace_back(pair.first, (-1 / (1 + std::pow(10, pKai->second - ph))));
+			}
+
+			normalized += "ph " + std::to_string(ph) + " hmm " + std::to_string(mHmmAngle) + " " +
+			              std::to_string(mHmmWindow) + "\n";
+
+			mChecksum = 0xcbf29ce484222325ULL;
+			for (auto c : normalized) {
+				mChecksum ^= static_cast<unsigned char>(c);
+				mChecksum *= 0x100000001b3ULL;
+			}
+		}
+
+		static const std::unordered_map<char, T>* scaleOf(const std::string& name) {
+			static const std::unordered_map<std::string, const std::unordered_map<char, T>*> table {
+					{"KuhnHydrov", &scales::KuhnHydrov<T>},
+					{"CID2", &scales::CID2<T>},
+					{"CID4", &scales::CID4<T>},
+					{"CID5", &scales::CID5<T>},
+					{"NormalizedEisenberg", &scales::NormalizedEisenberg<T>},
+					{"ManavalanPonnuswamy", &scales::ManavalanPonnuswamy<T>},
+					{"Ponnuswamy5", &scales::Ponnuswamy5<T>},
+					{"Prabhakaran", &scales::Prabhakaran<T>},
+					{"SweetEisenberg", &scales::SweetEisenberg<T>},
+					{"Zimmerman", &scales::Zimmerman<T>},
+					{"Wolfenden", &scales::Wolfenden<T>},
+					{"CasariSippl", &scales::CasariSippl<T>},
+					{"Tossi", &scales::Tossi<T>},
+					{"Klein", &scales::Klein<T>},
+					{"ChartonCTDC", &scales::ChartonCTDC<T>}
+			};
+
+			auto found = table.find(name);
+			return found == table.end() ? nullptr : found->second;
+		}
+
+		// The classes of the reduced alphabets (see "ras.h") are named after its residues
+		static bool isClassOf(const std::string& alphabet, const std::string& cls) {
+			static const std::unordered_map<std::string, std::vector<std::string>> table {
+					{"Std", {"A", "C", "D", "E", "F", "G", "H", "I", "K", "L", "M", "N", "P", "Q", "R", "S", "T",
+							        "V", "W", "Y"}},
+					{"Blosum50", {"FWY", "CLVIM", "H", "AG", "ST", "DENQ", "KR", "P"}},
+					{"HydrophobicityTomii", {"RKEDQN", "GASTPHY", "CLVIMFW"}},
+					{"NormVWTomii", {"GASTCPD", "NVEQIL", "MHKFRYW"}},
+					{"PolarityTomii", {"LIFWCMVY", "PATGS", "HQRKNED"}},
+					{"PolarizabilityTomii", {"GASDT", "CPNVEQIL", "KMHFRYW"}},
+					{"ChargeTomii", {"KR", "ANCQGHILMFPSTWYV", "DE"}},
+					{"SecondStructTomii", {"EALMQKRH", "VIYCWFT", "GNPSD"}},
+					{"SolventAccTomii", {"ALFCGIVW", "RKQEND", "MPSTHY"}}
+			};
+
+			auto found = table.find(alphabet);
+
+			if (found == table.end())
+				return false;
+
+			return std::find(found->second.cbegin(), found->second.cend(), cls) != found->second.cend();
+		}
+
+		//
+		// Fields
+		//
+		std::vector<Descriptor> mDescs;
+		std::vector<std::string> mClasses;
+		std::vector<size_t> mPairDescs;
+		std::vector<size_t> mTripDescs;
+		size_t mNumScales {0};
+		std::vector<T> mScaleTable;
+		std::array<uint64_t, NUM_CHARS> mClassMask {};
+		std::array<T, NUM_CHARS> mHmmScale {};
+		std::vector<T> mSin;
+		std::vector<T> mCos;
+		uint mHmmAngle {Globals::HMM_ANGLE};
+		uint mHmmWindow {Globals::HMM_WINDOW_SIZE};
+		std::vector<std::pair<char, ChargeT>> mPosCharges;
+		std::vector<std::pair<char, ChargeT>> mNegCharges;
+		uint64_t mChecksum {0};
+
+	};
+
+}
+
+#endif //INPROT_MD_SET_H
@@ -0,0 +1,169 @@
+#ifndef INPROT_MDS_WRITER_H
+#define INPROT_MDS_WRITER_H
+
+#include <string>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "globals.h"
+
+template <typename Condition>
+using EnableIf = typename std::enable_if<Condition::value>::type;
+
+namespace fasta {
+
+	// Streaming writer of a descriptors matrix (one row per k-mer, one column per molecular
+	// descriptor) in NPY format (row-major, little-endian), plus a text file ("<filename>.kmers")
+	// with one k-mer per line in the same order as the rows.
+	//
+	// The rows are written in blocks: a block is reserved (rows and bytes of the k-mers file) and
+	// then, every worker writes its own slice of the block with "pwrite" at its final position,
+	// without any lock and without keeping the matrix in memory. The NPY header (with the final
+	// number of rows) is written when the writer is closed.
+	template<typename T, EnableIf<std::is_floating_point<T>>...>
+	class MdsWriter {
+
+		static constexpr size_t NPY_HEADER_SIZE = 128;
+
+	public:
+		struct Block {
+			size_t firstRow;
+			size_t firstByte;   // First byte in the k-mers file
+		};
+
+		//
+		// Constructors & destructors
+		//
+		MdsWriter() = default;
+		MdsWriter(const MdsWriter&) = delete;
+		MdsWriter& operator=(const MdsWriter&) = delete;
+
+		~MdsWriter() {
+			close();
+		}
+
+		//
+		// Methods
+		//
+		bool open(const std::string& filename, size_t numCols = Globals::NUM_MDS) {
+			close();
+
+			mFd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			mKmersFd = ::open((filename + ".kmers").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+			if (mFd < 0 || mKmersFd < 0) {
+				close();
+				return false;
+			}
+
+			mNumCols = numCols;
+			mRows = 0;
+			mBytes = 0;
+			mFailed = false;
+
+			return writeHeader();
+		}
+
+		bool close() {
+			auto allOK = true;
+
+			if (mFd >= 0) {
+				allOK = writeHeader() && !mFailed;
+				::close(mFd);
+				mFd = -1;
+			}
+
+			if (mKmersFd >= 0) {
+				::close(mKmersFd);
+				mKmersFd = -1;
+			}
+
+			return allOK;
+		}
+
+		bool isOpen() const {
+			return mFd >= 0;
+		}
+
+		size_t getNumCols() const {
+			return mNumCols;
+		}
+
+		size_t getNumRows() const {
+			return mRows;
+		}
+
+		// Reserve "rows" rows and "kmersBytes" bytes in the k-mers file
+		Block reserve(size_t rows, size_t kmersBytes) {
+			return Block {mRows.fetch_add(rows), mBytes.fetch_add(kmersBytes)};
+		}
+
+		// Write "rows" rows (numCols values each one) starting at row "firstRow"
+		bool writeRows(size_t firstRow, const T* data, size_t rows) {
+			auto offset = NPY_HEADER_SIZE + firstRow * mNumCols * sizeof(T);
+			return writeAt(mFd, data, rows * mNumCols * sizeof(T), offset);
+		}
+
+		// Write the k-mers (already formatted, one per line) starting at byte "firstByte"
+		bool writeKmers(size_t firstByte, const char* data, size_t len) {
+			return writeAt(mKmersFd, data, len, firstByte);
+		}
+
+
+	private:
+		bool writeAt(int fd, const void* data, size_t len, size_t offset) {
+			auto ptr = static_cast<const char*>(data);
+
+			while (len > 0) {
+				auto written = pwrite(fd, ptr, len, static_cast<off_t>(offset));
+
+				if (written <= 0) {
+					mFailed = true;
+					return false;
+				}
+
+				ptr += written;
+				offset += static_cast<size_t>(written);
+				len -= static_cast<size_t>(written);
+			}
+
+			return true;
+		}
+
+		// NPY format 1.0: magic string, version, header length and a python dict literal padded
+		// with spaces. The header has a fixed size, so it can be rewritten with the final shape
+		bool writeHeader() {
+			std::string dict = "{'descr': '<f" + std::to_string(sizeof(T)) +
+			                   "', 'fortran_order': False, 'shape': (" + std::to_string(mRows.load()) + ", " +
+			                   std::to_string(mNumCols) + "), }";
+
+			std::string header = "\x93NUMPY";
+			header += static_cast<char>(1);
+			header += static_cast<char>(0);
+
+			auto dictLen = static_cast<uint16_t>(NPY_HEADER_SIZE - header.size() - 2);
+			header += static_cast<char>(dictLen & 0xff);
+			header += static_cast<char>(dictLen >> 8);
+
+			dict.resize(dictLen - 1, ' ');
+			header += dict + "\n";
+
+			return writeAt(mFd, header.data(), header.size(), 0);
+		}
+
+		//
+		// Fields
+		//
+		int mFd {-1};
+		int mKmersFd {-1};
+		size_t mNumCols {Globals::NUM_MDS};
+		std::atomic<size_t> mRows {0};
+		std::atomic<size_t> mBytes {0};
+		std::atomic<bool> mFailed {false};
+
+	};
+
+}
+
+#endif //INPROT_MDS_WRITER_H
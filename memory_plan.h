@@ -0,0 +1,104 @@
+#ifndef INPROT_MEMORY_PLAN_H
+#define INPROT_MEMORY_PLAN_H
+
+#include <algorithm>
+#include <limits>
+#include <unistd.h>
+#include "fasta_seq.h"
+#include "kmer_offset.h"
+#include "kmer_occurrences.h"
+#include "kmer_partitions.h"
+#include "suffix_index.h"
+
+namespace fasta {
+
+	// How the extraction and the shrinking use the memory, given a budget: the footprint of every
+	// phase (the sequences, the suffix array and the k-mers of a size with their occurrences, the
+	// occurrences of the AMPs and the groups of the shrinking) is estimated from the number of
+	// residues, and the phases that do not fit are moved to disk: the k-mers are partitioned into
+	// on-disk buckets only if a size does not fit, and only the occurrences of the AMPs beyond
+	// their share of the budget are spilled.
+	struct MemoryPlan {
+		static constexpr size_t UNLIMITED = std::numeric_limits<size_t>::max();
+
+		bool partitioned {false};       // Extract the k-mers by on-disk buckets
+		size_t numBuckets {1};
+		size_t maxBatches {1};          // K-mer sizes in flight in the extraction pipeline
+		size_t ampBudget {UNLIMITED};   // Bytes of the occurrences of the AMPs kept in memory
+		size_t windowSize {1 << 22};    // Occurrences of the AMPs shrinked at a time
+
+		// Plan for the sequences "fseqs" and the k-mer sizes [lower, upper] within "limit" bytes (0 =
+		// no limit, but the pipeline is kept within half of the physical memory). In aware mode, all
+		// the occurrences of the AMPs are spilled
+		static MemoryPlan make(const FastaSeqs& fseqs, uint lower, uint upper, size_t limit,
+		                       bool awareMode, bool keepOccurrences) {
+			MemoryPlan plan;
+			size_t positions {0};
+			auto seqBytes = fseqs.bytes();
+
+			for (const auto& fs : fseqs)
+				positions += fs.length() + 1;
+
+			size_t numSizes = upper - lower + 1;
+			auto useIndex = upper > lower && SuffixIndex::fits(fseqs);
+
+			// The k-mers of a size (up to one per position) and, if kept, their occurrences
+			auto batchBytes = std::max<size_t>(1, positions * (keepOccurrences ? BATCH_OCCS_BYTES : BATCH_BYTES));
+			auto indexBytes = useIndex ? positions * INDEX_BYTES : 0;
+			auto buildBytes = useIndex ? positions * INDEX_BUILD_BYTES : 0;
+
+			// Aware mode: a single k-mer size in flight and no occurrences of the AMPs in memory
+			if (awareMode) {
+				plan.ampBudget = 0;
+				numSizes = 1;
+			}
+
+			if (limit == 0) {
+				auto pages = sysconf(_SC_PHYS_PAGES);
+				auto pageSize = sysconf(_SC_PAGE_SIZE);
+				auto budget = (pages > 0 && pageSize > 0) ? static_cast<size_t>(pages) * static_cast<size_t>(pageSize) / 2 : 0;
+
+				plan.maxBatches = std::max<size_t>(1, std::min({numSizes, MAX_BATCHES, budget / batchBytes}));
+				return plan;
+			}
+
+			auto available = (limit > seqBytes) ? limit - seqBytes : 0;
+
+			// The extraction takes what it needs (the pipeline overlaps more sizes only within half
+			// of the budget) and the rest is for the occurrences of the AMPs
+			if (std::max(buildBytes, indexBytes + batchBytes) <= available) {
+				auto extraBatches = (available / 2 > indexBytes + batchBytes) ?
+				                    (available / 2 - indexBytes - batchBytes) / batchBytes : 0;
+
+				plan.maxBatches = std::min({numSizes, MAX_BATCHES, 1 + extraBatches});
+				available -= indexBytes + plan.maxBatches * batchBytes;
+			} else {
+				plan.partitioned = true;
+				plan.numBuckets = KmerPartitions::numBuckets(fseqs, lower, std::max<size_t>(1, available / 2));
+				available -= available / 2;
+			}
+
+			plan.ampBudget = std::min(plan.ampBudget, available);
+			plan.windowSize = std::max(size_t {MIN_WINDOW}, std::min(plan.windowSize, available / WINDOW_OCC_BYTES));
+
+			return plan;
+		}
+
+	private:
+		// Approximate bytes per position: k-mers of a size (hashes and sorting included), plus their
+		// occurrences (representative, begin, occurrence and order), the suffix array (while it is
+		// built and afterwards) and every occurrence of an AMP being shrinked (with its group)
+		static constexpr size_t BATCH_BYTES = 2 * sizeof(KmerOffset);
+		static constexpr size_t BATCH_OCCS_BYTES = BATCH_BYTES + 2 * sizeof(KmerOccurrences::Occurrence) +
+		                                           sizeof(size_t) + sizeof(uint32_t);
+		static constexpr size_t INDEX_BYTES = 11;
+		static constexpr size_t INDEX_BUILD_BYTES = 31;
+		static constexpr size_t WINDOW_OCC_BYTES = 2 * sizeof(KmerOffset);
+		static constexpr size_t MAX_BATCHES = 3;
+		static constexpr size_t MIN_WINDOW = 1 << 16;
+
+	};
+
+}
+
+#endif //INPROT_MEMORY_PLAN_H
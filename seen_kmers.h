@@ -0,0 +1,167 @@
+#ifndef INPROT_SEEN_KMERS_H
+#define INPROT_SEEN_KMERS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <tbb/tbb.h>
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "kmer_hash.h"
+#include "kmer_offset.h"
+#include "thread_buffers.h"
+
+namespace fasta {
+
+	// 128-bit fingerprint of a k-mer: two polynomial hashes (with different bases) of its residues,
+	// extended one residue at a time, so all the k-mers that start at the same offset are
+	// fingerprinted in one pass
+	class KmerFingerprint {
+
+	public:
+		static constexpr uint64_t BASE2 = 0x9e3779b97f4a7c15ULL;
+
+		// "probe" tells apart different k-mers with the same fingerprint (see "SeenKmers::visit")
+		struct Key {
+			uint64_t hi;
+			uint64_t lo;
+			uint32_t probe;
+
+			bool operator==(const Key& rhs) const noexcept {
+				return hi == rhs.hi && lo == rhs.lo && probe == rhs.probe;
+			}
+		};
+
+		// Append the residue "in" to the fingerprinted k-mer
+		void extend(char in) noexcept {
+			auto c = KmerHash::code(in);
+			mH1 = mH1 * KmerHash::BASE + c;
+			mH2 = mH2 * BASE2 + c;
+			++mSize;
+		}
+
+		// The size is part of the key, so a k-mer and its extensions never share a key
+		Key key() const noexcept {
+			return Key {KmerHash::mix(mH1 ^ mSize), mH2, 0};
+		}
+
+		uint size() const noexcept {
+			return mSize;
+		}
+
+	private:
+		uint64_t mH1 {0};
+		uint64_t mH2 {0};
+		uint mSize {0};
+
+	};
+
+	// Concurrent set of the k-mers (of any size) already seen, with their number of occurrences.
+	// The first occurrence of a k-mer is the one evaluated, and the occurrence kept as its
+	// representative is the lowest one (by sequence index and offset), whatever the order in which
+	// the occurrences are visited. The k-mers are found by their fingerprints and verified against
+	// the residues of the sequences.
+	class SeenKmers {
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		explicit SeenKmers(const FastaSeqs& fseqs): mFseqs(fseqs) { }
+
+		//
+		// Methods
+		//
+
+		// Visit the occurrence (seqIdx, offset) of the k-mer with the fingerprint "fp". If the k-mer
+		// was not seen before, "evaluate" is called on it (while the rest of the occurrences of the
+		// same k-mer wait)
+		template<typename F>
+		void visit(const KmerFingerprint& fp, size_t seqIdx, size_t offset, F&& evaluate) {
+			Map::accessor acc;
+			auto key = fp.key();
+			auto kmer = mFseqs[seqIdx].data() + offset;
+			bool inserted;
+
+			// A different k-mer with the same fingerprint (a collision) is probed for with the next key
+			while (!(inserted = mMap.insert(acc, key)) && (acc->second.getSize() != fp.size() ||
+					std::memcmp(acc->second.data(mFseqs), kmer, fp.size()) != 0)) {
+				acc.release();
+				++key.probe;
+			}
+
+			if (inserted) {
+				acc->second = KmerOffset(seqIdx, offset, fp.size());
+				evaluate(acc->second);
+				return;
+			}
+
+			auto& rep = acc->second;
+
+			if (seqIdx < rep.getSeqIdx() || (seqIdx == rep.getSeqIdx() && offset < rep.getOffset())) {
+				auto count = rep.getCount();
+				rep = KmerOffset(seqIdx, offset, fp.size(), rep.isAMP());
+				rep.setCount(count);
+			}
+
+			rep.addCount(1);
+		}
+
+		// Unique (and evaluated) k-mers of the sizes [lower, upper], one vector per size
+		std::vector<std::vector<KmerOffset>> kmers(uint lower, uint upper) const {
+			auto numSizes = upper - lower + 1;
+
+			tbb::enumerable_thread_specific<std::vector<std::vector<KmerOffset>>> localKmers(
+					[numSizes] { return std::vector<std::vector<KmerOffset>>(numSizes); });
+
+			tbb::parallel_for(mMap.range(), [&] (const Map::const_range_type& r) {
+				auto& bySize = localKmers.local();
+
+				for (auto it = r.begin(); it != r.end(); ++it) {
+					const auto& koff = it->second;
+
+					if (koff.getSize() >= lower && koff.getSize() <= upper)
+						bySize[koff.getSize() - lower].push_back(koff);
+				}
+			});
+
+			std::vector<std::vector<KmerOffset>> all(numSizes);
+
+			for (size_t i = 0; i < numSizes; ++i) {
+				std::vector<std::vector<KmerOffset>> buffers;
+
+				for (auto& bySize : localKmers)
+					buffers.emplace_back(std::move(bySize[i]));
+
+				if (!buffers.empty())
+					all[i] = ThreadBuffers::concat(buffers);
+			}
+
+			return all;
+		}
+
+		size_t size() const {
+			return mMap.size();
+		}
+
+	private:
+		struct KeyHashCompare {
+			static size_t hash(const KmerFingerprint::Key& key) {
+				return static_cast<size_t>(key.hi + key.probe * KmerFingerprint::BASE2);
+			}
+
+			static bool equal(const KmerFingerprint::Key& lhs, const KmerFingerprint::Key& rhs) {
+				return lhs == rhs;
+			}
+		};
+
+		using Map = tbb::concurrent_hash_map<KmerFingerprint::Key, KmerOffset, KeyHashCompare>;
+
+		const FastaSeqs& mFseqs;
+		Map mMap;
+
+	};
+
+}
+
+#endif //INPROT_SEEN_KMERS_H
@@ -0,0 +1,96 @@
+#ifndef INPROT_SEQ_CHUNKS_H
+#define INPROT_SEQ_CHUNKS_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <tbb/task_arena.h>
+#include "fasta_seq.h"
+
+namespace fasta {
+
+	// Chunk of work over the k-mers of the sequences: either a batch of whole (short) sequences,
+	// [firstSeq, lastSeq), or a part of one long sequence, the k-mers that start at [begin, end)
+	// (so consecutive parts overlap by k - 1 residues)
+	struct SeqChunk {
+		uint32_t firstSeq;
+		uint32_t lastSeq;
+		uint32_t begin;
+		uint32_t end;
+
+		// First and last (exclusive) starts of the k-mers of size "ksize" to take from a sequence
+		// of this chunk whose length is "len"
+		std::pair<size_t, size_t> starts(size_t len, size_t ksize) const {
+			if (ksize > len)
+				return std::make_pair(size_t {0}, size_t {0});
+
+			auto stop = std::min<size_t>(end, len - ksize + 1);
+			return std::make_pair(std::min<size_t>(begin, stop), stop);
+		}
+	};
+
+	class SeqChunks {
+
+	public:
+		// Chunks of about "chunkSize" k-mers each (by default, enough chunks for 8 per thread): the
+		// short sequences are batched together and the long ones are split
+		static std::vector<SeqChunk> split(const FastaSeqs& fseqs, size_t ksize, size_t chunkSize = 0) {
+			if (chunkSize == 0)
+				chunkSize = defaultChunkSize(fseqs);
+
+			std::vector<SeqChunk> chunks;
+			size_t batchKmers {0};
+			uint32_t batchFirst {0};
+
+			for (uint32_t i = 0; i < fseqs.size(); ++i) {
+				auto len = fseqs[i].length();
+				auto numKmers = (ksize > len) ? 0 : len - ksize + 1;
+
+				if (numKmers <= chunkSize) {
+					if (batchKmers + numKmers > chunkSize) {
+						chunks.push_back(SeqChunk {batchFirst, i, 0, NO_END});
+						batchFirst = i;
+						batchKmers = 0;
+					}
+
+					batchKmers += numKmers;
+					continue;
+				}
+
+				// Close the current batch and split the long sequence
+				if (batchFirst < i)
+					chunks.push_back(SeqChunk {batchFirst, i, 0, NO_END});
+
+				for (size_t begin = 0; begin < numKmers; begin += chunkSize) {
+					auto end = std::min(begin + chunkSize, numKmers);
+					chunks.push_back(SeqChunk {i, i + 1, static_cast<uint32_t>(begin), static_cast<uint32_t>(end)});
+				}
+
+				batchFirst = i + 1;
+				batchKmers = 0;
+			}
+
+			if (batchFirst < fseqs.size())
+				chunks.push_back(SeqChunk {batchFirst, static_cast<uint32_t>(fseqs.size()), 0, NO_END});
+
+			return chunks;
+		}
+
+	private:
+		static constexpr uint32_t NO_END = std::numeric_limits<uint32_t>::max();
+
+		static size_t defaultChunkSize(const FastaSeqs& fseqs) {
+			size_t residues {0};
+
+			for (const auto& fs : fseqs)
+				residues += fs.length();
+
+			auto threads = static_cast<size_t>(std::max(1, tbb::this_task_arena::max_concurrency()));
+			return std::min<size_t>(std::max<size_t>(residues / (8 * threads), 4'096), 1 << 20);
+		}
+
+	};
+
+}
+
+#endif //INPROT_SEQ_CHUNKS_H
@@ -0,0 +1,258 @@
+#ifndef INPROT_SUFFIX_INDEX_H
+#define INPROT_SUFFIX_INDEX_H
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <tbb/tbb.h>
+#include <tbb/concurrent_vector.h>
+#include "fasta_seq.h"
+#include "kmer_offset.h"
+#include "kmer_hash.h"
+#include "kmer_key.h"
+#include "thread_buffers.h"
+#include "kmer_occurrences.h"
+
+namespace fasta {
+
+	// Generalized suffix array (with LCP) of all the sequences, sorted up to a maximum depth (the
+	// upper k-mer size) by prefix doubling, starting from the packed keys of their first residues.
+	// Built once, the distinct k-mers of any size k <= depth are the LCP intervals of the array: a
+	// new k-mer starts at every suffix whose LCP with the previous one is lower than k, so they are
+	// obtained with a linear scan instead of enumerating and sorting the proteome again for every k.
+	class SuffixIndex {
+
+		// Sorting key of a suffix: its first residues (packed) or the ranks of its first and next
+		// "depth" residues
+		struct SuffixKey {
+			uint64_t key;
+			uint32_t pos;
+
+			bool operator<(const SuffixKey& rhs) const {
+				return key < rhs.key || (key == rhs.key && pos < rhs.pos);
+			}
+		};
+
+	public:
+		//
+		// Constructors & destructors
+		//
+		explicit SuffixIndex(const FastaSeqs& fseqs, uint maxDepth):
+				mFseqs(fseqs), mMaxDepth(std::min<uint>(maxDepth, std::numeric_limits<uint8_t>::max())) {
+			build();
+		}
+
+		SuffixIndex(const SuffixIndex&) = delete;
+		SuffixIndex& operator=(const SuffixIndex&) = delete;
+
+		//
+		// Methods
+		//
+
+		// The index only addresses proteomes with less than 2^32 residues
+		static bool fits(const FastaSeqs& fseqs) {
+			size_t total {0};
+
+			for (const auto& fs : fseqs)
+				total += fs.length() + 1;
+
+			return total < std::numeric_limits<uint32_t>::max();
+		}
+
+		// Unique k-mers of size "ksize" (as "FastaUtils::uniqKmers", between equal k-mers, the one of
+		// the first sequence and lowest offset is kept, along with the size of the interval as its
+		// number of occurrences). If "occurrences" is given, the occurrences of every unique k-mer
+		// (the members of its interval) are kept in it.
+		std::vector<KmerOffset> uniqKmers(uint ksize, KmerOccurrences* occurrences = nullptr) const {
+			if (occurrences != nullptr)
+				*occurrences = KmerOccurrences();
+
+			if (ksize == 0 || ksize > mMaxDepth || mSA.empty())
+				return std::vector<KmerOffset>();
+
+			// The array is scanned in blocks, each one with its own output
+			constexpr size_t blockSize {16'384};
+			std::vector<std::vector<KmerOffset>> blockUniqs((mSA.size() + blockSize - 1) / blockSize);
+			std::vector<KmerOccurrences> blockOccs(occurrences != nullptr ? blockUniqs.size() : 0);
+
+			tbb::parallel_for(size_t {0}, blockUniqs.size(), [&] (size_t block) {
+				auto& uniqs = blockUniqs[block];
+				auto i = block * blockSize;
+				auto end = std::min(i + blockSize, mSA.size());
+
+				// The interval that begins before this block belongs to the previous block
+				while (i < end && mLCP[i] >= ksize)
+					++i;
+
+				while (i < end) {
+					auto first = i;
+					auto minPos = mSA[i];
+					auto valid = mDepth[i] >= ksize;
+
+					// Members of the interval (it could end after this block)
+					for (++i; i < mSA.size() && mLCP[i] >= ksize; ++i)
+						minPos = std::min(minPos, mSA[i]);
+
+					if (valid) {
+						auto seqIdx = mSeqIdx[minPos];
+						uniqs.emplace_back(seqIdx, minPos - mStarts[seqIdx], ksize);
+						uniqs.back().setCount(i - first);
+
+						if (occurrences != nullptr) {
+							auto& kmerOccs = blockOccs[block];
+							kmerOccs.addKmer();
+							kmerOccs.setRepresentative(seqIdx, minPos - mStarts[seqIdx]);
+
+							for (auto j = first; j < i; ++j) {
+								auto pos = mSA[j];
+								kmerOccs.addOccurrence(mSeqIdx[pos], pos - mStarts[mSeqIdx[pos]]);
+							}
+						}
+					}
+				}
+			});
+
+			if (occurrences != nullptr)
+				*occurrences = KmerOccurrences::concat(blockOccs);
+
+			return ThreadBuffers::concat(blockUniqs);
+		}
+
+
+	private:
+		// Concatenate the sequences (residue codes, 0 as separator) and sort their suffixes by
+		// prefix doubling (up to "mMaxDepth" residues)
+		void build() {
+			mStarts.resize(mFseqs.size() + 1, 0);
+
+			for (size_t i = 0; i < mFseqs.size(); ++i)
+				mStarts[i + 1] = mStarts[i] + static_cast<uint32_t>(mFseqs[i].length() + 1);
+
+			auto textSize = mStarts.back();
+			mText.assign(textSize, 0);
+			mSeqIdx.resize(textSize);
+
+			tbb::parallel_for(size_t {0}, mFseqs.size(), [&] (size_t i) {
+				const auto& seq = mFseqs[i];
+				std::transform(seq.data(), seq.data() + seq.length(), mText.begin() + mStarts[i], KmerHash::code);
+				std::fill(mSeqIdx.begin() + mStarts[i], mSeqIdx.begin() + mStarts[i + 1], static_cast<uint32_t>(i));
+			});
+
+			// Suffixes (separators excluded), keyed by their first residues (packed)
+			std::vector<uint32_t> ranks(textSize, 0);
+			std::vector<SuffixKey> keys;
+			keys.reserve(textSize - mFseqs.size());
+
+			for (uint32_t pos = 0; pos < textSize; ++pos) {
+				if (mText[pos] != 0)
+					keys.push_back(SuffixKey {0, pos});
+			}
+
+			auto depth = KmerKey::maxSize<uint64_t>();
+
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, keys.size()), [&] (const auto& r) {
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					auto pos = keys[i].pos;
+					uint64_t key {0};
+
+					for (uint j = 0; j < depth; ++j) {
+						key <<= KmerKey::BITS_PER_RESIDUE;
+						key |= (mText[pos] != 0) ? mText[pos++] : 0;
+					}
+
+					keys[i].key = key << (KmerKey::width<uint64_t>() - KmerKey::BITS_PER_RESIDUE * depth);
+				}
+			});
+
+			std::vector<uint32_t> heads(keys.size());
+
+			for (; !keys.empty(); depth *= 2) {
+				tbb::parallel_sort(keys.begin(), keys.end());
+
+				// Sorted by the first "depth" residues: new ranks (1..n) as the prefix sum of the
+				// heads of every group of equal keys
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, keys.size()), [&] (const auto& r) {
+					for (auto i = r.begin(); i != r.end(); ++i)
+						heads[i] = (i == 0 || keys[i].key != keys[i - 1].key) ? 1 : 0;
+				});
+
+				auto numRanks = tbb::parallel_scan(tbb::blocked_range<size_t>(0, keys.size()), uint32_t {0},
+						[&] (const tbb::blocked_range<size_t>& r, uint32_t sum, bool isFinal) {
+							for (auto i = r.begin(); i != r.end(); ++i) {
+								sum += heads[i];
+
+								if (isFinal)
+									ranks[keys[i].pos] = sum;
+							}
+
+							return sum;
+						},
+						[] (uint32_t lhs, uint32_t rhs) { return lhs + rhs; });
+
+				if (depth >= mMaxDepth || numRanks == keys.size())
+					break;
+
+				// Next keys: ranks of the first and next "depth" residues
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, keys.size()), [&] (const auto& r) {
+					for (auto i = r.begin(); i != r.end(); ++i) {
+						auto pos = keys[i].pos;
+						uint64_t next = (pos + depth < textSize) ? ranks[pos + depth] : 0;
+						keys[i].key = (static_cast<uint64_t>(ranks[pos]) << 32) | next;
+					}
+				});
+			}
+
+			std::vector<uint32_t>().swap(heads);
+			std::vector<uint32_t>().swap(ranks);
+
+			mSA.resize(keys.size());
+			mDepth.resize(keys.size());
+			mLCP.resize(keys.size(), 0);
+
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, keys.size()), [&] (const auto& r) {
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					mSA[i] = keys[i].pos;
+					mDepth[i] = static_cast<uint8_t>(std::min<uint32_t>(remaining(mSA[i]), mMaxDepth));
+				}
+			});
+
+			std::vector<SuffixKey>().swap(keys);
+
+			// LCP (capped at "mMaxDepth") of every suffix with the previous one
+			tbb::parallel_for(tbb::blocked_range<size_t>(1, mSA.size()), [&] (const auto& r) {
+				for (auto i = r.begin(); i != r.end(); ++i) {
+					auto a = mSA[i - 1];
+					auto b = mSA[i];
+					uint lcp {0};
+
+					while (lcp < mMaxDepth && mText[a + lcp] != 0 && mText[a + lcp] == mText[b + lcp])
+						++lcp;
+
+					mLCP[i] = static_cast<uint8_t>(lcp);
+				}
+			});
+		}
+
+		// Residues from "pos" to the end of its sequence
+		uint32_t remaining(uint32_t pos) const {
+			return mStarts[mSeqIdx[pos] + 1] - 1 - pos;
+		}
+
+		//
+		// Fields
+		//
+		const FastaSeqs& mFseqs;
+		uint mMaxDepth;
+		std::vector<uint32_t> mStarts;  // Start of every sequence in the concatenation (+ total size)
+		std::vector<uint8_t> mText;     // Residue codes of the concatenation
+		std::vector<uint32_t> mSeqIdx;  // Sequence of every position of the concatenation
+		std::vector<uint32_t> mSA;
+		std::vector<uint8_t> mDepth;    // Residues of every suffix (capped at "mMaxDepth")
+		std::vector<uint8_t> mLCP;
+
+	};
+
+}
+
+#endif //INPROT_SUFFIX_INDEX_H
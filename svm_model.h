@@ -29,7 +29,7 @@ namespace libsvm {
 	public:
 		SvmModel() = default;
 
-		bool load(const std::string& filename) {
+		bool load(const std::string& filename, size_t numMds = Globals::NUM_MDS) {
 			std::ifstream inFile(filename, std::ios_base::in | std::ios_base::binary);
 			readHeader(inFile);
 
@@ -42,11 +42,11 @@ namespace libsvm {
 				mSVCoef.emplace_back(0, ml);
 
 			// Reserve space for SVs and zero-fill them
-			// Each SV will be an array of size = Globals::NUM_MDS
+			// Each SV will be an array of size = numMds (the size of the descriptors set)
 			// filled with zeroes
 			mSV.reserve(ml);
 			for (size_t i = 0; i < ml; ++i)
-				mSV.emplace_back(0, Globals::NUM_MDS);
+				mSV.emplace_back(0, numMds);
 
 			std::string line;
 			size_t numLine {0};
@@ -82,11 +82,11 @@ namespace libsvm {
 				T val {0};
 				while (ss >> idx >> separator >> val) {
 
-					if (idx < 1 || idx > Globals::NUM_MDS) {
+					if (idx < 1 || idx > numMds) {
 						throw std::runtime_error(
 								"SV's index is outside of range (#SV=" + std::to_string(numLine + 1) +
 										"). Current index: " + std::to_string(idx) + ". Valid range: [1," +
-										std::to_string(Globals::NUM_MDS) + "]");
+										std::to_string(numMds) + "]");
 					}
 
 					mSV[numLine][--idx] = val;
@@ -98,6 +98,10 @@ public:
 		return true;
 	}
 
+	size_t size() const {
+		return mBounds.size();
+	}
+
 	bool scale(std::valarray<T>& mds) const {
 		if (mds.size() != mBounds.size())
 			return false;
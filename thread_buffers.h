@@ -0,0 +1,54 @@
+#ifndef INPROT_THREAD_BUFFERS_H
+#define INPROT_THREAD_BUFFERS_H
+
+#include <vector>
+#include <algorithm>
+#include <tbb/tbb.h>
+#include <tbb/enumerable_thread_specific.h>
+
+namespace fasta {
+
+	// Merging of buffers filled independently (per thread, per range or per shard) into one
+	// contiguous vector, instead of having all the threads appending to a shared concurrent_vector.
+	class ThreadBuffers {
+
+	public:
+		// Concatenate (in order) the buffers: each one is copied, in parallel, at the prefix sum of
+		// the sizes of the previous ones and then released
+		template<typename T>
+		static std::vector<T> concat(std::vector<std::vector<T>>& buffers) {
+			std::vector<size_t> offsets(buffers.size() + 1, 0);
+
+			for (size_t i = 0; i < buffers.size(); ++i)
+				offsets[i + 1] = offsets[i] + buffers[i].size();
+
+			if (buffers.size() == 1)
+				return std::move(buffers[0]);
+
+			std::vector<T> all(offsets.back());
+
+			tbb::parallel_for(size_t {0}, buffers.size(), [&] (size_t i) {
+				std::copy(buffers[i].cbegin(), buffers[i].cend(), all.begin() + offsets[i]);
+				std::vector<T>().swap(buffers[i]);
+			});
+
+			return all;
+		}
+
+		// Concatenate the buffers of all the threads (in no particular order)
+		template<typename T>
+		static std::vector<T> concat(tbb::enumerable_thread_specific<std::vector<T>>& buffers) {
+			std::vector<std::vector<T>> all;
+			all.reserve(buffers.size());
+
+			for (auto& buffer : buffers)
+				all.emplace_back(std::move(buffer));
+
+			return concat(all);
+		}
+
+	};
+
+}
+
+#endif //INPROT_THREAD_BUFFERS_H